@@ -0,0 +1,46 @@
+#include "alpha_index.h"
+
+#include <cstddef>
+
+namespace {
+
+SpanKind Classify(unsigned char alpha) {
+    if(alpha == 0) {
+        return SpanKind::TRANSPARENT;
+    }
+    return alpha == MAX_ALPHA ? SpanKind::OPAQUE : SpanKind::PARTIAL;
+}
+
+} // namespace
+
+void AlphaIndex::AddRow(const unsigned char* row, int width, const PixelLayout& layout) {
+    size_t row_start = spans_.size();
+    if(!layout.HasAlpha()) {
+        if(width) {
+            spans_.push_back({0, width, SpanKind::OPAQUE});
+        }
+        row_starts_.push_back(static_cast<int>(spans_.size()));
+        return;
+    }
+
+    const unsigned char* alpha = row + layout.channel_bytes[3];
+    int step = layout.BytesPerPixel();
+    int begin = 0;
+    while(begin < width) {
+        SpanKind kind = Classify(alpha[begin * step]);
+        int end = begin + 1;
+        while(end < width && Classify(alpha[end * step]) == kind) {
+            ++end;
+        }
+        if(kind != SpanKind::PARTIAL && end - begin < MIN_UNIFORM_SPAN) {
+            kind = SpanKind::PARTIAL;
+        }
+        if(kind == SpanKind::PARTIAL && spans_.size() > row_start && spans_.back().kind == SpanKind::PARTIAL) {
+            spans_.back().end = end;
+        } else {
+            spans_.push_back({begin, end, kind});
+        }
+        begin = end;
+    }
+    row_starts_.push_back(static_cast<int>(spans_.size()));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "pixel_format.h"
+
+// Transparent and opaque runs shorter than this are blended as part of the surrounding partial span,
+// the per-span dispatch would cost more than it saves.
+const int MIN_UNIFORM_SPAN = 16;
+
+enum class SpanKind : unsigned char {
+    TRANSPARENT, // alpha 0
+    OPAQUE,      // alpha MAX_ALPHA
+    PARTIAL,
+};
+
+struct AlphaSpan {
+    int begin = 0;
+    int end = 0;
+    SpanKind kind = SpanKind::PARTIAL;
+};
+
+// Per-row run-length summary of a picture's alpha channel, built once and reused by every composite
+// of that picture as a source.
+class AlphaIndex {
+    private:
+        std::vector<AlphaSpan> spans_;
+        std::vector<int> row_starts_ = {0};
+
+    public:
+        // Rows have to be added bottom to top, like BMPFile::Row counts them.
+        void AddRow(const unsigned char* row, int width, const PixelLayout& layout);
+
+        const AlphaSpan* RowBegin(int row) const noexcept {
+            return spans_.data() + row_starts_[row];
+        }
+
+        const AlphaSpan* RowEnd(int row) const noexcept {
+            return spans_.data() + row_starts_[row + 1];
+        }
+};
@@ -0,0 +1,1082 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bmp_file.h"
+#include "stream_compose.h"
+
+// Benchmarks and regression checks for the blender.
+// Every result is printed as one JSON object per line; the exit code is 1 if any correctness check failed.
+//
+//   blender_bench [--quick] [--reps N] [--warmup N] [--check-only] [--pictures DIR]
+
+namespace {
+
+const double TARGET_SAMPLE_SECONDS = 2e-4; // short operations are repeated until a sample takes this long
+const int POOL_THREADS = 4;                 // thread count of the pool variant, whatever the hardware
+
+struct BenchConfig {
+    bool quick = false;
+    bool check_only = false;
+    int reps = 31;
+    int warmup = 3;
+    std::string pictures = "pictures";
+};
+
+enum class AlphaDistribution {
+    OPAQUE,
+    TRANSPARENT,
+    UNIFORM, // every alpha value equally likely
+    SPRITE,  // opaque disc, transparent corners, random alpha on the rim
+};
+
+const char* AlphaName(AlphaDistribution alpha) {
+    switch(alpha) {
+        case AlphaDistribution::OPAQUE:      return "opaque";
+        case AlphaDistribution::TRANSPARENT: return "transparent";
+        case AlphaDistribution::UNIFORM:     return "uniform";
+        case AlphaDistribution::SPRITE:      return "sprite";
+    }
+    return "unknown";
+}
+
+const char* ModeName(BlendMode mode) {
+    switch(mode) {
+        case BlendMode::SOURCE_OVER_OPAQUE: return "source_over_opaque";
+        case BlendMode::OVER:               return "over";
+        case BlendMode::IN:                 return "in";
+        case BlendMode::OUT:                return "out";
+        case BlendMode::ATOP:               return "atop";
+        case BlendMode::XOR:                return "xor";
+        case BlendMode::MULTIPLY:           return "multiply";
+        case BlendMode::SCREEN:             return "screen";
+        case BlendMode::ADD:                return "add";
+    }
+    return "unknown";
+}
+
+struct Stats {
+    double median = 0;
+    double p99 = 0;
+    double min = 0;
+};
+
+Stats Summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    Stats stats;
+    stats.min = samples.front();
+    stats.median = samples[samples.size() / 2];
+    stats.p99 = samples[std::min(samples.size() - 1, static_cast<size_t>(samples.size() * 0.99))];
+    return stats;
+}
+
+double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Seconds per call of `operation`: warmup calls first (they also pick how many calls make up a sample),
+// then `reps` timed samples.
+template <class Operation>
+Stats Measure(const BenchConfig& config, Operation&& operation) {
+    int calls = 1;
+    for(int i = 0; i < config.warmup; ++i) {
+        double start = Now();
+        operation();
+        double elapsed = Now() - start;
+        if(elapsed > 0) {
+            calls = std::max(calls, static_cast<int>(TARGET_SAMPLE_SECONDS / elapsed));
+        }
+    }
+    std::vector<double> samples;
+    for(int i = 0; i < config.reps; ++i) {
+        double start = Now();
+        for(int call = 0; call < calls; ++call) {
+            operation();
+        }
+        samples.push_back((Now() - start) / calls);
+    }
+    return Summarize(samples);
+}
+
+void PrintStats(const Stats& stats, int reps, double pixels, double bytes) {
+    printf("\"reps\":%d,\"median_ms\":%.6f,\"p99_ms\":%.6f,\"min_ms\":%.6f,\"mpix_per_s\":%.2f,\"gb_per_s\":%.3f}\n",
+           reps, stats.median * 1e3, stats.p99 * 1e3, stats.min * 1e3, pixels / stats.median * 1e-6, bytes / stats.median * 1e-9);
+    fflush(stdout);
+}
+
+void FillPicture(BMPFile& picture, AlphaDistribution alpha, unsigned seed) {
+    std::mt19937 random(seed);
+    for(int row = 0; row < picture.Height(); ++row) {
+        unsigned char* pixels = picture.Row(row);
+        for(int column = 0; column < picture.Width(); ++column) {
+            unsigned char* pixel = pixels + column * BYTES_PER_PIXEL;
+            uint32_t value = random();
+            pixel[0] = value;
+            pixel[1] = value >> 8;
+            pixel[2] = value >> 16;
+            switch(alpha) {
+                case AlphaDistribution::OPAQUE:      pixel[3] = MAX_ALPHA; break;
+                case AlphaDistribution::TRANSPARENT: pixel[3] = 0; break;
+                case AlphaDistribution::UNIFORM:     pixel[3] = value >> 24; break;
+                case AlphaDistribution::SPRITE: {
+                    double dx = (column + 0.5) / picture.Width() - 0.5;
+                    double dy = (row + 0.5) / picture.Height() - 0.5;
+                    double radius = 4 * (dx * dx + dy * dy);
+                    pixel[3] = radius < 0.6 ? MAX_ALPHA : radius > 1.0 ? 0 : value >> 24;
+                    break;
+                }
+            }
+        }
+    }
+    picture.InvalidateAlphaIndex();
+}
+
+// Straight per-pixel copy of the original ComposeAlpha formula, shares no code with the kernels.
+// Source pixels that land outside `dest` are skipped.
+void ReferenceCompose(BMPFile& dest, const BMPFile& src, int x, int y) {
+    for(int row = 0; row < src.Height(); ++row) {
+        for(int column = 0; column < src.Width(); ++column) {
+            if(x + column < 0 || x + column >= dest.Width() || y + row < 0 || y + row >= dest.Height()) {
+                continue;
+            }
+            const unsigned char* src_pixel = src.Pixel(column, row);
+            unsigned char* dest_pixel = dest.Pixel(x + column, y + row);
+            int alpha = src_pixel[3];
+            for(int channel = 0; channel < 3; ++channel) {
+                dest_pixel[channel] = (src_pixel[channel] * alpha + dest_pixel[channel] * (MAX_ALPHA - alpha)) >> MAX_ALPHA_POW;
+            }
+            dest_pixel[3] = MAX_ALPHA;
+        }
+    }
+}
+
+// Bilinear sampling in double precision, shares no code with OverlayResampler. Every destination pixel
+// center is mapped back through the inverse transform, the four premultiplied source pixels around it are
+// weighted and blended over the destination; source pixels outside the overlay count as transparent.
+// Only the inputs are quantized like the resampler's: 8-bit premultiplied pixels (ReferencePremultiply)
+// and weights in steps of 1 / RESAMPLE_WEIGHT_ONE.
+void ReferenceTransformed(BMPFile& dest, const BMPFile& src, const OverlayTransform& transform) {
+    double determinant = static_cast<double>(transform.xx) * transform.yy - static_cast<double>(transform.xy) * transform.yx;
+    for(int row = 0; row < dest.Height(); ++row) {
+        for(int column = 0; column < dest.Width(); ++column) {
+            double x = column + 0.5 - transform.x;
+            double y = row + 0.5 - transform.y;
+            double u = (transform.yy * x - transform.xy * y) / determinant - 0.5;
+            double v = (transform.xx * y - transform.yx * x) / determinant - 0.5;
+            if(!(u > -1 && u < src.Width() && v > -1 && v < src.Height())) {
+                continue;
+            }
+            int left = static_cast<int>(std::floor(u));
+            int bottom = static_cast<int>(std::floor(v));
+            u = left + std::round((u - left) * RESAMPLE_WEIGHT_ONE) / RESAMPLE_WEIGHT_ONE;
+            v = bottom + std::round((v - bottom) * RESAMPLE_WEIGHT_ONE) / RESAMPLE_WEIGHT_ONE;
+            double sample[4] = {};
+            for(int tap_row = bottom; tap_row <= bottom + 1; ++tap_row) {
+                for(int tap_column = left; tap_column <= left + 1; ++tap_column) {
+                    if(tap_column < 0 || tap_column >= src.Width() || tap_row < 0 || tap_row >= src.Height()) {
+                        continue;
+                    }
+                    double weight = (1 - std::abs(u - tap_column)) * (1 - std::abs(v - tap_row));
+                    const unsigned char* pixel = src.Pixel(tap_column, tap_row);
+                    for(int channel = 0; channel < 4; ++channel) {
+                        sample[channel] += weight * pixel[channel];
+                    }
+                }
+            }
+            unsigned char* dest_pixel = dest.Pixel(column, row);
+            for(int channel = 0; channel < 4; ++channel) {
+                double blended = sample[channel] + dest_pixel[channel] * (1 - sample[3] / MAX_ALPHA);
+                dest_pixel[channel] = static_cast<unsigned char>(std::clamp(std::round(blended), 0.0, 255.0));
+            }
+        }
+    }
+}
+
+// round(c * a / 255) per color channel, shares no code with the kernels.
+void ReferencePremultiply(BMPFile& picture) {
+    for(int row = 0; row < picture.Height(); ++row) {
+        for(int column = 0; column < picture.Width(); ++column) {
+            unsigned char* pixel = picture.Pixel(column, row);
+            for(int channel = 0; channel < 3; ++channel) {
+                pixel[channel] = (pixel[channel] * pixel[3] + MAX_ALPHA / 2) / MAX_ALPHA;
+            }
+        }
+    }
+}
+
+// A stored BMP layout, encoded by hand so the format check shares no code with pixel_format.cpp.
+struct FileFormat {
+    const char* name;
+    uint16_t bit_count;
+    uint32_t header_size; // a BMP_INFO_HEADER_SIZE header is followed by the three BI_BITFIELDS masks
+    uint32_t masks[4];    // B, G, R, A for BI_BITFIELDS, a zero alpha mask for none; unused for 24 bits
+    bool top_down;
+
+    bool HasAlpha() const {
+        return bit_count == 32 && masks[3] != 0;
+    }
+};
+
+std::vector<FileFormat> FileFormats() {
+    return {
+        {"bgr24", 24, BMP_INFO_HEADER_SIZE, {}, false},
+        {"bgr24_top_down", 24, BMP_INFO_HEADER_SIZE, {}, true},
+        {"bgra32", 32, BMP_V5_HEADER_SIZE, {0xFF, 0xFF00, 0xFF0000, 0xFF000000}, false},
+        {"rgba32_top_down", 32, BMP_V5_HEADER_SIZE, {0xFF0000, 0xFF00, 0xFF, 0xFF000000}, true},
+        {"xrgb32", 32, BMP_V5_HEADER_SIZE, {0xFF000000, 0xFF0000, 0xFF00, 0}, false},
+        // the slot a V5 header keeps the alpha mask in holds the first pixels here
+        {"bgrx32_info_header_top_down", 32, BMP_INFO_HEADER_SIZE, {0xFF, 0xFF00, 0xFF0000, 0}, true},
+    };
+}
+
+// The whole file for a BGRA picture stored as `format`; channels the format lacks are dropped.
+std::vector<unsigned char> EncodeFile(const BMPFile& picture, const FileFormat& format) {
+    bool bitfields = format.bit_count == 32;
+    int bytes_per_pixel = format.bit_count / 8;
+    size_t stride = (picture.Width() * bytes_per_pixel + 3) & ~3;
+    size_t header_bytes = BMP_FILE_HEADER_SIZE + format.header_size;
+    if(bitfields && format.header_size == BMP_INFO_HEADER_SIZE) {
+        header_bytes += 3 * sizeof(uint32_t);
+    }
+
+    BMPHeader header;
+    header.bfType = BMP_FILE_TYPE;
+    header.bfOffBits = header_bytes;
+    header.bfSize = header_bytes + stride * picture.Height();
+    header.bV5Size = format.header_size;
+    header.bV5Width = picture.Width();
+    header.bV5Height = format.top_down ? static_cast<uint32_t>(-picture.Height()) : picture.Height();
+    header.bV5Planes = 1;
+    header.bV5BitCount = format.bit_count;
+    header.biV5Compression = bitfields ? BMP_COMPRESSION_BITFIELDS : BMP_COMPRESSION_RGB;
+    header.bV5SizeImage = stride * picture.Height();
+    header.bV5BlueMask = format.masks[0];
+    header.bV5GreenMask = format.masks[1];
+    header.bV5RedMask = format.masks[2];
+    header.bV5AlphaMask = format.masks[3];
+
+    std::vector<unsigned char> file(header.bfSize);
+    memcpy(file.data(), &header, std::min(header_bytes, sizeof(BMPHeader)));
+    for(int row = 0; row < picture.Height(); ++row) {
+        int stored_row = format.top_down ? picture.Height() - 1 - row : row;
+        unsigned char* stored = file.data() + header_bytes + stored_row * stride;
+        for(int column = 0; column < picture.Width(); ++column) {
+            const unsigned char* pixel = picture.Pixel(column, row);
+            for(int channel = 0; channel < 4; ++channel) {
+                if(bitfields ? format.masks[channel] != 0 : channel < 3) {
+                    int byte = bitfields ? __builtin_ctz(format.masks[channel]) / 8 : channel;
+                    stored[column * bytes_per_pixel + byte] = pixel[channel];
+                }
+            }
+        }
+    }
+    return file;
+}
+
+// The pixels the blender sees in a picture stored as `format`: no alpha channel reads as opaque.
+BMPFile Effective(const BMPFile& picture, const FileFormat& format) {
+    BMPFile effective = BMPFile::Create(picture.Width(), picture.Height());
+    for(int row = 0; row < picture.Height(); ++row) {
+        memcpy(effective.Row(row), picture.Row(row), picture.Width() * BYTES_PER_PIXEL);
+        for(int column = 0; !format.HasAlpha() && column < picture.Width(); ++column) {
+            effective.Pixel(column, row)[3] = MAX_ALPHA;
+        }
+    }
+    return effective;
+}
+
+void WriteFile(const std::string& filename, const std::vector<unsigned char>& bytes) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if(!file || fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+        fprintf(stderr, "could not write %s\n", filename.c_str());
+        exit(2);
+    }
+    fclose(file);
+}
+
+struct TransformCase {
+    const char* name;
+    OverlayTransform matrix; // offset ignored
+
+    OverlayTransform Placed(float x, float y) const {
+        OverlayTransform transform = matrix;
+        transform.x = x;
+        transform.y = y;
+        return transform;
+    }
+
+    // destination pixels covered by a size x size overlay
+    double Area(int size) const {
+        return std::abs(static_cast<double>(matrix.xx) * matrix.yy - static_cast<double>(matrix.xy) * matrix.yx) * size * size;
+    }
+};
+
+std::vector<TransformCase> TransformCases() {
+    return {
+        {"shrink_0.5", OverlayTransform::Place(0, 0, 0.5f)},
+        {"enlarge_1.5", OverlayTransform::Place(0, 0, 1.5f)},
+        {"enlarge_3", OverlayTransform::Place(0, 0, 3.0f)},
+        {"rotate_30", {0.866f, -0.5f, 0.5f, 0.866f, 0, 0}},
+    };
+}
+
+bool SamePixels(const BMPFile& first, const BMPFile& second) {
+    return first.Size() == second.Size() && memcmp(first.Data(), second.Data(), first.Size()) == 0;
+}
+
+// largest per-channel difference, 256 for pictures of different sizes
+int MaxDifference(const BMPFile& first, const BMPFile& second) {
+    if(first.Width() != second.Width() || first.Height() != second.Height()) {
+        return 256;
+    }
+    int difference = 0;
+    for(int row = 0; row < first.Height(); ++row) {
+        for(int byte = 0; byte < first.Width() * BYTES_PER_PIXEL; ++byte) {
+            difference = std::max(difference, std::abs(first.Row(row)[byte] - second.Row(row)[byte]));
+        }
+    }
+    return difference;
+}
+
+struct Variant {
+    BlendKernel kernel;
+    bool alpha_spans;
+    int threads;
+};
+
+std::vector<Variant> Variants() {
+    std::vector<Variant> variants;
+    for(BlendKernel kernel : {BlendKernel::SCALAR, BlendKernel::SSE41, BlendKernel::AVX2, BlendKernel::AVX512}) {
+        if(IsBlendKernelSupported(kernel)) {
+            variants.push_back({kernel, false, 1});
+        }
+    }
+    variants.push_back({DetectBlendKernel(), true, 1});
+    // a pool even on a single core, so the band and tile splits are always exercised
+    variants.push_back({DetectBlendKernel(), true, POOL_THREADS});
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    if(threads > POOL_THREADS) {
+        variants.push_back({DetectBlendKernel(), true, threads});
+    }
+    return variants;
+}
+
+void PrintVariant(const Variant& variant) {
+    printf("\"kernel\":\"%s\",\"alpha_spans\":%s,\"threads\":%d,", BlendKernelName(variant.kernel),
+           variant.alpha_spans ? "true" : "false", variant.threads);
+}
+
+// Prints one JSON line per check result and counts the failures.
+struct CheckReport {
+    int failures = 0;
+
+    void operator()(const char* check, const Variant& variant, const std::string& detail, bool passed) {
+        printf("{\"check\":\"%s\",", check);
+        PrintVariant(variant);
+        printf("\"case\":\"%s\",\"passed\":%s}\n", detail.c_str(), passed ? "true" : "false");
+        failures += !passed;
+    }
+};
+
+ComposeOptions VariantOptions(const Variant& variant, ThreadPool& pool, int band_rows = 0) {
+    ComposeOptions options;
+    options.kernel = variant.kernel;
+    options.alpha_spans = variant.alpha_spans;
+    options.pool = &pool;
+    options.band_rows = band_rows;
+    return options;
+}
+
+std::string TemporaryFile(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// golden_cat_book.bmp was produced by the original per-pixel SSE code and is never written by blender,
+// which overwrites composed.bmp on every run
+void CheckGolden(const BenchConfig& config, CheckReport& report) {
+    std::string cat = config.pictures + "/cat.bmp";
+    std::string book = config.pictures + "/book.bmp";
+    std::string golden = config.pictures + "/golden_cat_book.bmp";
+    if(!std::filesystem::exists(golden)) {
+        report("golden", Variant{}, "missing golden_cat_book.bmp", false);
+        return;
+    }
+    BMPFile expected(golden.c_str());
+    BMPFile overlay(book.c_str());
+    for(const Variant& variant : Variants()) {
+        ThreadPool pool(variant.threads);
+        BMPFile canvas(cat.c_str());
+        canvas.ComposeAlpha(overlay, 20, 400, VariantOptions(variant, pool));
+        report("golden", variant, "cat+book", SamePixels(canvas, expected));
+    }
+}
+
+// odd sizes so every kernel runs through its tail handling
+void CheckReference(CheckReport& report) {
+    for(AlphaDistribution alpha : {AlphaDistribution::OPAQUE, AlphaDistribution::TRANSPARENT,
+                                   AlphaDistribution::UNIFORM, AlphaDistribution::SPRITE}) {
+        BMPFile overlay = BMPFile::Create(141, 77);
+        FillPicture(overlay, alpha, 7);
+        BMPFile expected = BMPFile::Create(333, 211);
+        FillPicture(expected, AlphaDistribution::OPAQUE, 11);
+        ReferenceCompose(expected, overlay, 13, 101);
+
+        for(const Variant& variant : Variants()) {
+            ThreadPool pool(variant.threads);
+            BMPFile canvas = BMPFile::Create(333, 211);
+            FillPicture(canvas, AlphaDistribution::OPAQUE, 11);
+            canvas.ComposeAlpha(overlay, 13, 101, VariantOptions(variant, pool, 5));
+            report("reference", variant, AlphaName(alpha), SamePixels(canvas, expected));
+        }
+    }
+}
+
+// every mode with straight and premultiplied sources against the scalar kernel; the sprite has transparent,
+// opaque and partial runs, so the span fast paths are compared as well
+void CheckModes(CheckReport& report) {
+    for(BlendMode mode : {BlendMode::SOURCE_OVER_OPAQUE, BlendMode::OVER, BlendMode::IN, BlendMode::OUT, BlendMode::ATOP,
+                          BlendMode::XOR, BlendMode::MULTIPLY, BlendMode::SCREEN, BlendMode::ADD}) {
+        for(bool premultiplied : {false, true}) {
+            BMPFile overlay = BMPFile::Create(141, 77);
+            FillPicture(overlay, AlphaDistribution::SPRITE, 7);
+            if(premultiplied) {
+                overlay.Premultiply(BlendKernel::SCALAR);
+            }
+            auto compose = [&](const ComposeOptions& options) {
+                BMPFile canvas = BMPFile::Create(333, 211);
+                FillPicture(canvas, AlphaDistribution::UNIFORM, 11);
+                if(mode != BlendMode::SOURCE_OVER_OPAQUE) {
+                    canvas.Premultiply(BlendKernel::SCALAR);
+                }
+                canvas.ComposeAlpha(overlay, 13, 101, options);
+                return canvas;
+            };
+            ComposeOptions scalar;
+            scalar.kernel = BlendKernel::SCALAR;
+            scalar.mode = mode;
+            scalar.alpha_spans = false;
+            BMPFile expected = compose(scalar);
+
+            std::string name = std::string(ModeName(mode)) + (premultiplied ? "/premultiplied" : "/straight");
+            for(const Variant& variant : Variants()) {
+                ThreadPool pool(variant.threads);
+                ComposeOptions options = VariantOptions(variant, pool, 5);
+                options.mode = mode;
+                report("mode", variant, name, SamePixels(compose(options), expected));
+            }
+        }
+    }
+}
+
+// Premultiply against the per-pixel formula; Unpremultiply has to give back pixels that premultiply
+// to the same bytes again
+void CheckPremultiply(CheckReport& report) {
+    BMPFile premultiplied = BMPFile::Create(141, 77);
+    FillPicture(premultiplied, AlphaDistribution::UNIFORM, 7);
+    ReferencePremultiply(premultiplied);
+    for(BlendKernel kernel : {BlendKernel::SCALAR, BlendKernel::SSE41, BlendKernel::AVX2, BlendKernel::AVX512}) {
+        if(!IsBlendKernelSupported(kernel)) {
+            continue;
+        }
+        BMPFile picture = BMPFile::Create(141, 77);
+        FillPicture(picture, AlphaDistribution::UNIFORM, 7);
+        picture.Premultiply(kernel);
+        report("premultiply", Variant{kernel, false, 1}, "uniform", SamePixels(picture, premultiplied));
+        picture.Unpremultiply();
+        picture.Premultiply(kernel);
+        report("unpremultiply", Variant{kernel, false, 1}, "uniform", SamePixels(picture, premultiplied));
+    }
+}
+
+// overlapping layers across tile borders with repeated z values, against ComposeAlpha one layer at a
+// time in stable z order; the serial path and a pool must give the same bytes
+void CheckLayers(CheckReport& report) {
+    std::mt19937 random(19);
+    std::vector<BMPFile> layer_images;
+    for(int image = 0; image < 8; ++image) {
+        layer_images.push_back(BMPFile::Create(31 + random() % 270, 17 + random() % 140));
+        FillPicture(layer_images.back(), image % 2 ? AlphaDistribution::SPRITE : AlphaDistribution::UNIFORM, image);
+    }
+    std::vector<Layer> layers;
+    for(int index = 0; index < 40; ++index) {
+        const BMPFile& image = layer_images[random() % layer_images.size()];
+        int x = random() % (701 - image.Width());
+        int y = random() % (397 - image.Height());
+        layers.push_back({&image, x, y, static_cast<int>(random() % 3)});
+    }
+    std::vector<Layer> ordered = layers;
+    std::stable_sort(ordered.begin(), ordered.end(), [](const Layer& first, const Layer& second) {
+        return first.z < second.z;
+    });
+    BMPFile layered = BMPFile::Create(701, 397);
+    FillPicture(layered, AlphaDistribution::OPAQUE, 23);
+    ComposeOptions scalar_layers;
+    scalar_layers.kernel = BlendKernel::SCALAR;
+    scalar_layers.alpha_spans = false;
+    for(const Layer& layer : ordered) {
+        layered.ComposeAlpha(*layer.image, layer.x, layer.y, scalar_layers);
+    }
+    for(const Variant& variant : Variants()) {
+        ThreadPool pool(variant.threads);
+        BMPFile canvas = BMPFile::Create(701, 397);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 23);
+        canvas.ComposeLayers(layers, VariantOptions(variant, pool));
+        report("layers", variant, "40 layers", SamePixels(canvas, layered));
+    }
+    // tiles that do not divide the canvas and are narrower than most layers
+    for(const Variant& variant : Variants()) {
+        ThreadPool pool(variant.threads);
+        ComposeOptions options = VariantOptions(variant, pool);
+        options.tile_width = 48;
+        options.tile_height = 17;
+        BMPFile canvas = BMPFile::Create(701, 397);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 23);
+        canvas.ComposeLayers(layers, options);
+        report("layers", variant, "40 layers, 48x17 tiles", SamePixels(canvas, layered));
+    }
+}
+
+// The format and streaming checks compose a sprite wider than FORMAT_CHUNK_PIXELS at (5, 3) of this canvas.
+BMPFile FormatCanvas() {
+    BMPFile canvas = BMPFile::Create(1043, 37);
+    FillPicture(canvas, AlphaDistribution::UNIFORM, 13);
+    return canvas;
+}
+
+BMPFile FormatSprite() {
+    BMPFile sprite = BMPFile::Create(1031, 29);
+    FillPicture(sprite, AlphaDistribution::SPRITE, 17);
+    return sprite;
+}
+
+// every stored layout as destination and as overlay against the per-pixel reference. The overlay is wider
+// than FORMAT_CHUNK_PIXELS and its spans have odd lengths, so the converters run through their tails.
+void CheckFormats(CheckReport& report) {
+    std::string format_destination = TemporaryFile("blender_bench_format_dst.bmp");
+    std::string format_overlay = TemporaryFile("blender_bench_format_src.bmp");
+    BMPFile format_canvas = FormatCanvas();
+    BMPFile format_sprite = FormatSprite();
+    for(const FileFormat& dst_format : FileFormats()) {
+        for(const FileFormat& src_format : FileFormats()) {
+            WriteFile(format_destination, EncodeFile(format_canvas, dst_format));
+            WriteFile(format_overlay, EncodeFile(format_sprite, src_format));
+            BMPFile reference = Effective(format_canvas, dst_format);
+            ReferenceCompose(reference, Effective(format_sprite, src_format), 5, 3);
+            std::vector<unsigned char> expected = EncodeFile(reference, dst_format);
+
+            std::string name = std::string(dst_format.name) + "+" + src_format.name;
+            for(const Variant& variant : Variants()) {
+                bool passed = false;
+                try {
+                    ThreadPool pool(variant.threads);
+                    BMPFile overlay = BMPFile::Map(format_overlay.c_str(), MapMode::READ_ONLY);
+                    BMPFile canvas(format_destination.c_str());
+                    canvas.ComposeAlpha(overlay, 5, 3, VariantOptions(variant, pool, 5));
+                    passed = canvas.Size() == static_cast<int>(expected.size()) &&
+                             memcmp(canvas.Data(), expected.data(), expected.size()) == 0;
+                } catch(const std::exception& error) {
+                    fprintf(stderr, "%s: %s\n", name.c_str(), error.what());
+                }
+                report("format", variant, name, passed);
+            }
+        }
+    }
+    std::filesystem::remove(format_destination);
+    std::filesystem::remove(format_overlay);
+}
+
+// ComposeStreaming with bands of a few rows, bottom-up and top-down files, into a new file and in place,
+// against ComposeAlpha on the loaded destination
+void CheckStreaming(CheckReport& report) {
+    std::string format_destination = TemporaryFile("blender_bench_format_dst.bmp");
+    std::string format_overlay = TemporaryFile("blender_bench_format_src.bmp");
+    std::string stream_output = TemporaryFile("blender_bench_stream_out.bmp");
+    BMPFile format_canvas = FormatCanvas();
+    BMPFile format_sprite = FormatSprite();
+    std::vector<FileFormat> file_formats = FileFormats();
+    int stream_formats[][2] = {{2, 2}, {3, 2}, {2, 1}, {1, 3}}; // destination, overlay
+    for(auto& formats : stream_formats) {
+        const FileFormat& dst_format = file_formats[formats[0]];
+        const FileFormat& src_format = file_formats[formats[1]];
+        WriteFile(format_overlay, EncodeFile(format_sprite, src_format));
+        std::vector<unsigned char> destination = EncodeFile(format_canvas, dst_format);
+        WriteFile(format_destination, destination);
+        BMPFile expected(format_destination.c_str());
+        expected.ComposeAlpha(BMPFile(format_overlay.c_str()), 5, 3);
+
+        for(int band_rows : {1, 3, 0}) {
+            for(bool in_place : {false, true}) {
+                std::string name = std::string(dst_format.name) + "+" + src_format.name + "/band_rows_" +
+                                   std::to_string(band_rows) + (in_place ? "/in_place" : "");
+                bool passed = false;
+                try {
+                    StreamOptions options;
+                    options.band_rows = band_rows;
+                    WriteFile(format_destination, destination);
+                    const std::string& output = in_place ? format_destination : stream_output;
+                    ComposeStreaming(format_destination.c_str(), format_overlay.c_str(), 5, 3, output.c_str(), options);
+                    passed = SamePixels(BMPFile(output.c_str()), expected);
+                } catch(const std::exception& error) {
+                    fprintf(stderr, "%s: %s\n", name.c_str(), error.what());
+                }
+                report("streaming", Variant{DetectBlendKernel(), false, 1}, name, passed);
+            }
+        }
+    }
+    std::filesystem::remove(format_destination);
+    std::filesystem::remove(format_overlay);
+    std::filesystem::remove(stream_output);
+}
+
+// whole pixel offsets, partly outside the canvas, against the clipped per-pixel reference
+void CheckClipped(CheckReport& report) {
+    BMPFile overlay = BMPFile::Create(141, 77);
+    FillPicture(overlay, AlphaDistribution::SPRITE, 7);
+    for(const OverlayTransform& placement : {OverlayTransform::Place(-13, -7), OverlayTransform::Place(270, 180)}) {
+        BMPFile expected = BMPFile::Create(333, 211);
+        FillPicture(expected, AlphaDistribution::OPAQUE, 11);
+        ReferenceCompose(expected, overlay, static_cast<int>(placement.x), static_cast<int>(placement.y));
+
+        std::string name = "at_" + std::to_string(static_cast<int>(placement.x)) + "_" + std::to_string(static_cast<int>(placement.y));
+        for(const Variant& variant : Variants()) {
+            ThreadPool pool(variant.threads);
+            BMPFile canvas = BMPFile::Create(333, 211);
+            FillPicture(canvas, AlphaDistribution::OPAQUE, 11);
+            canvas.ComposeTransformed(overlay, placement, VariantOptions(variant, pool, 5));
+            report("clipped", variant, name, SamePixels(canvas, expected));
+        }
+    }
+}
+
+// Resampled overlays against the scalar kernel, bit exact, and against the floating point reference within 1.
+// The reference blends exactly, so it is compared with DIVIDE_255 rounding. Every transform leaves the
+// 333 x 211 canvas on at least one side. The top-down 24-bit copy of the overlay goes through the per-pixel
+// path of the resampler instead of the ResampleRow kernels.
+void CheckTransformed(CheckReport& report) {
+    auto make_overlay = [] {
+        BMPFile overlay = BMPFile::Create(141, 77);
+        FillPicture(overlay, AlphaDistribution::SPRITE, 7);
+        return overlay;
+    };
+    auto make_canvas = [] {
+        BMPFile canvas = BMPFile::Create(333, 211);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 11);
+        return canvas;
+    };
+    std::vector<std::pair<std::string, OverlayTransform>> transforms;
+    for(const TransformCase& transform : TransformCases()) {
+        transforms.push_back({transform.name, transform.Placed(-40.25f, 150.6f)});
+    }
+    transforms.push_back({"mirror_x_1.25", {-1.25f, 0.0f, 0.0f, 1.25f, 350.4f, 30.2f}});
+    transforms.push_back({"mirror_y_0.75", {0.75f, 0.0f, 0.0f, -0.75f, 10.6f, 40.3f}});
+    transforms.push_back({"rotate_200", {-0.9397f, 0.342f, -0.342f, -0.9397f, 300.5f, 60.25f}});
+    transforms.push_back({"shear_0.4", {1.0f, 0.4f, 0.0f, 1.0f, 250.7f, 150.1f}});
+
+    FileFormat bgr24_top_down = FileFormats()[1];
+    std::string overlay_file = TemporaryFile("blender_bench_transformed_src.bmp");
+    WriteFile(overlay_file, EncodeFile(make_overlay(), bgr24_top_down));
+    struct Source {
+        std::string name;
+        BMPFile picture;
+        BMPFile premultiplied; // the pixels the blender sees, for the reference
+    };
+    std::vector<Source> sources;
+    sources.push_back({"bgra32", make_overlay(), make_overlay()});
+    sources.push_back({bgr24_top_down.name, BMPFile(overlay_file.c_str()), Effective(make_overlay(), bgr24_top_down)});
+    std::filesystem::remove(overlay_file);
+    for(Source& source : sources) {
+        ReferencePremultiply(source.premultiplied);
+    }
+
+    for(const Source& source : sources) {
+        for(const auto& transform : transforms) {
+            std::string name = source.name + "_" + transform.first;
+            ComposeOptions scalar;
+            scalar.kernel = BlendKernel::SCALAR;
+            BMPFile expected = make_canvas();
+            expected.ComposeTransformed(source.picture, transform.second, scalar);
+            BMPFile reference = make_canvas();
+            ReferenceTransformed(reference, source.premultiplied, transform.second);
+
+            for(const Variant& variant : Variants()) {
+                ThreadPool pool(variant.threads);
+                ComposeOptions options = VariantOptions(variant, pool, 5);
+                BMPFile canvas = make_canvas();
+                canvas.ComposeTransformed(source.picture, transform.second, options);
+                report("transformed", variant, name, SamePixels(canvas, expected));
+
+                options.rounding = BlendRounding::DIVIDE_255;
+                canvas = make_canvas();
+                canvas.ComposeTransformed(source.picture, transform.second, options);
+                report("transformed_reference", variant, name, MaxDifference(canvas, reference) <= 1);
+            }
+        }
+    }
+}
+
+int CheckCorrectness(const BenchConfig& config) {
+    CheckReport report;
+    CheckGolden(config, report);
+    CheckReference(report);
+    CheckModes(report);
+    CheckPremultiply(report);
+    CheckLayers(report);
+    CheckFormats(report);
+    CheckStreaming(report);
+    CheckClipped(report);
+    CheckTransformed(report);
+    return report.failures;
+}
+
+void BenchCompose(const BenchConfig& config) {
+    std::vector<int> canvas_sizes = config.quick ? std::vector<int>{1024} : std::vector<int>{1024, 4096};
+    std::vector<int> overlay_sizes = config.quick ? std::vector<int>{64, 512} : std::vector<int>{64, 256, 1024};
+
+    for(int canvas_size : canvas_sizes) {
+        BMPFile canvas = BMPFile::Create(canvas_size, canvas_size);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 1);
+        for(int overlay_size : overlay_sizes) {
+            if(overlay_size > canvas_size) {
+                continue;
+            }
+            for(AlphaDistribution alpha : {AlphaDistribution::OPAQUE, AlphaDistribution::TRANSPARENT,
+                                           AlphaDistribution::UNIFORM, AlphaDistribution::SPRITE}) {
+                BMPFile overlay = BMPFile::Create(overlay_size, overlay_size);
+                FillPicture(overlay, alpha, 2);
+                for(const Variant& variant : Variants()) {
+                    ThreadPool pool(variant.threads);
+                    ComposeOptions options = VariantOptions(variant, pool);
+
+                    // walk the overlay across the canvas so the destination is not always in cache
+                    int position = 0;
+                    int steps = std::max(1, canvas_size - overlay_size);
+                    Stats stats = Measure(config, [&] {
+                        position = (position + 997) % steps;
+                        canvas.ComposeAlpha(overlay, position, (position * 7) % steps, options);
+                    });
+
+                    double pixels = static_cast<double>(overlay_size) * overlay_size;
+                    printf("{\"benchmark\":\"compose\",\"canvas\":%d,\"overlay\":%d,\"alpha\":\"%s\",",
+                           canvas_size, overlay_size, AlphaName(alpha));
+                    PrintVariant(variant);
+                    // source read, destination read and destination write
+                    PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+                }
+            }
+        }
+    }
+}
+
+// The same composites with and without the AlphaIndex span shortcuts, for the rounding and modes they
+// can skip or copy pixels in, on the detected kernel and one thread.
+void BenchSpans(const BenchConfig& config) {
+    struct Setup {
+        const char* name;
+        BlendMode mode;
+        BlendRounding rounding;
+    };
+    const Setup setups[] = {
+        {"shift", BlendMode::SOURCE_OVER_OPAQUE, BlendRounding::SHIFT},
+        {"divide_255", BlendMode::SOURCE_OVER_OPAQUE, BlendRounding::DIVIDE_255},
+        {"over", BlendMode::OVER, BlendRounding::SHIFT},
+    };
+    int canvas_size = 1024;
+    std::vector<int> overlay_sizes = config.quick ? std::vector<int>{32, 256} : std::vector<int>{32, 64, 256, 1024};
+
+    for(const Setup& setup : setups) {
+        BMPFile canvas = BMPFile::Create(canvas_size, canvas_size);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 1);
+        if(setup.mode != BlendMode::SOURCE_OVER_OPAQUE) {
+            canvas.Premultiply();
+        }
+        for(int overlay_size : overlay_sizes) {
+            for(AlphaDistribution alpha : {AlphaDistribution::OPAQUE, AlphaDistribution::TRANSPARENT,
+                                           AlphaDistribution::UNIFORM, AlphaDistribution::SPRITE}) {
+                BMPFile overlay = BMPFile::Create(overlay_size, overlay_size);
+                FillPicture(overlay, alpha, 2);
+                if(setup.mode != BlendMode::SOURCE_OVER_OPAQUE) {
+                    overlay.Premultiply();
+                }
+                for(bool alpha_spans : {false, true}) {
+                    Variant variant = {DetectBlendKernel(), alpha_spans, 1};
+                    ThreadPool pool(variant.threads);
+                    ComposeOptions options = VariantOptions(variant, pool);
+                    options.mode = setup.mode;
+                    options.rounding = setup.rounding;
+
+                    int position = 0;
+                    int steps = std::max(1, canvas_size - overlay_size);
+                    Stats stats = Measure(config, [&] {
+                        position = (position + 997) % steps;
+                        canvas.ComposeAlpha(overlay, position, (position * 7) % steps, options);
+                    });
+
+                    double pixels = static_cast<double>(overlay_size) * overlay_size;
+                    printf("{\"benchmark\":\"spans\",\"setup\":\"%s\",\"canvas\":%d,\"overlay\":%d,\"alpha\":\"%s\",",
+                           setup.name, canvas_size, overlay_size, AlphaName(alpha));
+                    PrintVariant(variant);
+                    PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+                }
+            }
+        }
+    }
+}
+
+void BenchTransformed(const BenchConfig& config) {
+    int canvas_size = config.quick ? 1024 : 4096;
+    int overlay_size = 256;
+    BMPFile canvas = BMPFile::Create(canvas_size, canvas_size);
+    FillPicture(canvas, AlphaDistribution::OPAQUE, 1);
+    BMPFile overlay = BMPFile::Create(overlay_size, overlay_size);
+    FillPicture(overlay, AlphaDistribution::SPRITE, 2);
+
+    for(const TransformCase& transform : TransformCases()) {
+        for(const Variant& variant : Variants()) {
+            if(variant.alpha_spans) {
+                continue; // resampled rows are not run-length indexed
+            }
+            ThreadPool pool(variant.threads);
+            ComposeOptions options = VariantOptions(variant, pool);
+
+            // fractional positions, so every column and row really is interpolated
+            int position = 0;
+            int steps = std::max(1, canvas_size - 4 * overlay_size);
+            Stats stats = Measure(config, [&] {
+                position = (position + 997) % steps;
+                canvas.ComposeTransformed(overlay, transform.Placed(position + 0.3f, (position * 7) % steps + 0.7f), options);
+            });
+
+            double pixels = transform.Area(overlay_size);
+            printf("{\"benchmark\":\"transformed\",\"canvas\":%d,\"overlay\":%d,\"transform\":\"%s\",",
+                   canvas_size, overlay_size, transform.name);
+            PrintVariant(variant);
+            PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+        }
+    }
+}
+
+// `picture` repeated times x times, both are BGRA32 like every picture Create makes.
+BMPFile Tiled(const BMPFile& picture, int times) {
+    BMPFile tiled = BMPFile::Create(picture.Width() * times, picture.Height() * times);
+    for(int row = 0; row < tiled.Height(); ++row) {
+        for(int tile = 0; tile < times; ++tile) {
+            memcpy(tiled.Pixel(tile * picture.Width(), row), picture.Row(row % picture.Height()), picture.Width() * BYTES_PER_PIXEL);
+        }
+    }
+    return tiled;
+}
+
+// One large cat+book compose on pools of 1, 2, 4 ... threads, up to the hardware threads and at least
+// POOL_THREADS. The canvas is cat.bmp tiled 3 x 3 (6 x 6 without --quick), the overlay book.bmp tiled twice
+// as often, so every row band is a few hundred KiB and the speedup over 1 thread shows how far the band
+// split scales.
+void BenchThreads(const BenchConfig& config) {
+    std::string cat = config.pictures + "/cat.bmp";
+    std::string book = config.pictures + "/book.bmp";
+    if(!std::filesystem::exists(cat) || !std::filesystem::exists(book)) {
+        fprintf(stderr, "threads benchmark skipped, no cat.bmp and book.bmp in %s\n", config.pictures.c_str());
+        return;
+    }
+    int times = config.quick ? 3 : 6;
+    BMPFile canvas = Tiled(BMPFile(cat.c_str()), times);
+    BMPFile overlay = Tiled(BMPFile(book.c_str()), 2 * times);
+    if(overlay.Width() + 20 > canvas.Width() || overlay.Height() + 400 > canvas.Height()) {
+        fprintf(stderr, "threads benchmark skipped, book.bmp is too large for cat.bmp\n");
+        return;
+    }
+
+    int hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+    std::vector<int> thread_counts;
+    for(int threads = 1; threads <= std::max(POOL_THREADS, hardware_threads); threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    if(hardware_threads > thread_counts.back()) {
+        thread_counts.push_back(hardware_threads);
+    }
+
+    double serial = 0;
+    for(int threads : thread_counts) {
+        Variant variant = {DetectBlendKernel(), false, threads};
+        ThreadPool pool(threads);
+        ComposeOptions options = VariantOptions(variant, pool);
+        Stats stats = Measure(config, [&] {
+            canvas.ComposeAlpha(overlay, 20, 400, options);
+        });
+        if(threads == 1) {
+            serial = stats.median;
+        }
+
+        double pixels = static_cast<double>(overlay.Width()) * overlay.Height();
+        printf("{\"benchmark\":\"threads\",\"canvas\":\"%dx%d\",\"overlay\":\"%dx%d\",\"speedup\":%.2f,",
+               canvas.Width(), canvas.Height(), overlay.Width(), overlay.Height(), serial / stats.median);
+        PrintVariant(variant);
+        PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+    }
+}
+
+// Many small sprites composed one ComposeAlpha call at a time against one ComposeLayers call, over a few
+// tile sizes, to tune COMPOSE_TILE_WIDTH x COMPOSE_TILE_HEIGHT.
+void BenchLayers(const BenchConfig& config) {
+    std::vector<int> canvas_sizes = config.quick ? std::vector<int>{1024} : std::vector<int>{1024, 4096};
+    const int tile_sizes[][2] = {{64, 32}, {128, 64}, {256, 128}, {512, 256}};
+
+    std::mt19937 random(29);
+    std::vector<BMPFile> sprites;
+    for(int size : {32, 48, 64, 96}) {
+        sprites.push_back(BMPFile::Create(size, size));
+        FillPicture(sprites.back(), AlphaDistribution::SPRITE, size);
+    }
+    for(int canvas_size : canvas_sizes) {
+        BMPFile canvas = BMPFile::Create(canvas_size, canvas_size);
+        FillPicture(canvas, AlphaDistribution::OPAQUE, 1);
+        for(int count : {300, 2000}) {
+            std::vector<Layer> layers;
+            double pixels = 0;
+            for(int index = 0; index < count; ++index) {
+                const BMPFile& sprite = sprites[random() % sprites.size()];
+                int x = random() % (canvas_size - sprite.Width());
+                int y = random() % (canvas_size - sprite.Height());
+                layers.push_back({&sprite, x, y, static_cast<int>(random() % 4)});
+                pixels += static_cast<double>(sprite.Width()) * sprite.Height();
+            }
+            std::vector<Layer> ordered = layers;
+            std::stable_sort(ordered.begin(), ordered.end(), [](const Layer& first, const Layer& second) {
+                return first.z < second.z;
+            });
+
+            for(const Variant& variant : Variants()) {
+                if(variant.kernel != DetectBlendKernel()) {
+                    continue;
+                }
+                ThreadPool pool(variant.threads);
+                ComposeOptions options = VariantOptions(variant, pool);
+
+                Stats stats = Measure(config, [&] {
+                    for(const Layer& layer : ordered) {
+                        canvas.ComposeAlpha(*layer.image, layer.x, layer.y, options);
+                    }
+                });
+                printf("{\"benchmark\":\"layers\",\"canvas\":%d,\"layers\":%d,\"method\":\"sequential\",",
+                       canvas_size, count);
+                PrintVariant(variant);
+                PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+
+                for(const auto& tile : tile_sizes) {
+                    options.tile_width = tile[0];
+                    options.tile_height = tile[1];
+                    stats = Measure(config, [&] {
+                        canvas.ComposeLayers(layers, options);
+                    });
+                    printf("{\"benchmark\":\"layers\",\"canvas\":%d,\"layers\":%d,\"method\":\"tiled\","
+                           "\"tile_width\":%d,\"tile_height\":%d,",
+                           canvas_size, count, tile[0], tile[1]);
+                    PrintVariant(variant);
+                    PrintStats(stats, config.reps, pixels, pixels * BYTES_PER_PIXEL * 3);
+                }
+            }
+        }
+    }
+}
+
+void BenchFiles(const BenchConfig& config) {
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::vector<int> sizes = config.quick ? std::vector<int>{1024} : std::vector<int>{1024, 4096};
+
+    for(int size : sizes) {
+        std::string input = (directory / ("blender_bench_" + std::to_string(size) + ".bmp")).string();
+        std::string output = (directory / ("blender_bench_" + std::to_string(size) + "_out.bmp")).string();
+        std::string overlay = (directory / ("blender_bench_" + std::to_string(size) + "_overlay.bmp")).string();
+        {
+            BMPFile picture = BMPFile::Create(size, size);
+            FillPicture(picture, AlphaDistribution::UNIFORM, 3);
+            picture.SaveToFile(input.c_str());
+        }
+        double bytes = static_cast<double>(size) * size * BYTES_PER_PIXEL + BMP_V5_PIXELS_OFFSET;
+        double pixels = static_cast<double>(size) * size;
+
+        auto print = [&](const char* operation, const Stats& stats) {
+            printf("{\"benchmark\":\"file\",\"operation\":\"%s\",\"size\":%d,", operation, size);
+            PrintStats(stats, config.reps, pixels, bytes);
+        };
+
+        print("load_read", Measure(config, [&] {
+            BMPFile picture(input.c_str());
+        }));
+        // mapping alone is lazy, touch every page to get the cost of actually reading the pixels
+        print("load_map", Measure(config, [&] {
+            BMPFile picture = BMPFile::Map(input.c_str(), MapMode::READ_ONLY);
+            volatile unsigned char sink = 0;
+            for(int offset = 0; offset < picture.Size(); offset += 4096) {
+                sink = sink + picture.Data()[offset];
+            }
+        }));
+        BMPFile picture(input.c_str());
+        print("save", Measure(config, [&] {
+            picture.SaveToFile(output.c_str());
+        }));
+        // a quarter-size overlay streamed in: half of the destination rows go through the bands, the other
+        // half is copied file to file, or left alone when composing in place
+        {
+            BMPFile sprite = BMPFile::Create(size / 2, size / 2);
+            FillPicture(sprite, AlphaDistribution::SPRITE, 4);
+            sprite.SaveToFile(overlay.c_str());
+        }
+        print("compose_streaming", Measure(config, [&] {
+            ComposeStreaming(input.c_str(), overlay.c_str(), size / 4, size / 4, output.c_str());
+        }));
+        std::filesystem::copy_file(input, output, std::filesystem::copy_options::overwrite_existing);
+        print("compose_streaming_in_place", Measure(config, [&] {
+            ComposeStreaming(output.c_str(), overlay.c_str(), size / 4, size / 4, output.c_str());
+        }));
+
+        std::filesystem::remove(input);
+        std::filesystem::remove(output);
+        std::filesystem::remove(overlay);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    for(int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if(argument == "--quick") {
+            config.quick = true;
+            config.reps = 9;
+            config.warmup = 2;
+        } else if(argument == "--check-only") {
+            config.check_only = true;
+        } else if(argument == "--reps" && i + 1 < argc) {
+            config.reps = std::max(1, atoi(argv[++i]));
+        } else if(argument == "--warmup" && i + 1 < argc) {
+            config.warmup = std::max(1, atoi(argv[++i]));
+        } else if(argument == "--pictures" && i + 1 < argc) {
+            config.pictures = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--reps N] [--warmup N] [--check-only] [--pictures DIR]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("{\"cpu_kernel\":\"%s\",\"hardware_threads\":%u}\n", BlendKernelName(DetectBlendKernel()),
+           std::thread::hardware_concurrency());
+    int failures = CheckCorrectness(config);
+    if(!config.check_only) {
+        BenchCompose(config);
+        BenchSpans(config);
+        BenchTransformed(config);
+        BenchLayers(config);
+        BenchThreads(config);
+        BenchFiles(config);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,463 @@
+#include "blend.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <immintrin.h>
+
+namespace {
+
+template <BlendRounding ROUNDING>
+inline unsigned char ScaleScalar(int value) {
+    if constexpr (ROUNDING == BlendRounding::SHIFT) {
+        return value >> MAX_ALPHA_POW;
+    } else {
+        value += 1 << (MAX_ALPHA_POW - 1);
+        return (value + (value >> MAX_ALPHA_POW)) >> MAX_ALPHA_POW;
+    }
+}
+
+template <BlendRounding ROUNDING, bool SRC_PREMULTIPLIED>
+void BlendRowScalar(unsigned char* dst, const unsigned char* src, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        int src_alpha = src[i + 3];
+        int src_weight = SRC_PREMULTIPLIED ? MAX_ALPHA : src_alpha;
+        for(int channel = 0; channel < 3; ++channel) {
+            dst[i + channel] = ScaleScalar<ROUNDING>(src[i + channel] * src_weight + dst[i + channel] * (MAX_ALPHA - src_alpha));
+        }
+        dst[i + 3] = MAX_ALPHA;
+    }
+}
+
+template <BlendRounding ROUNDING>
+void BlendTransparentRowScalar(unsigned char* dst, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        for(int channel = 0; channel < 3; ++channel) {
+            dst[i + channel] = ScaleScalar<ROUNDING>(dst[i + channel] * MAX_ALPHA);
+        }
+        dst[i + 3] = MAX_ALPHA;
+    }
+}
+
+void BlendOpaqueRowScalar(unsigned char* dst, const unsigned char* src, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        for(int channel = 0; channel < 3; ++channel) {
+            dst[i + channel] = ScaleScalar<BlendRounding::SHIFT>(src[i + channel] * MAX_ALPHA);
+        }
+        dst[i + 3] = MAX_ALPHA;
+    }
+}
+
+inline int Mul255Scalar(int a, int b) {
+    int product = a * b + (1 << (MAX_ALPHA_POW - 1));
+    return (product + (product >> MAX_ALPHA_POW)) >> MAX_ALPHA_POW;
+}
+
+template <BlendMode MODE, bool SRC_PREMULTIPLIED>
+void CompositeRowScalar(unsigned char* dst, const unsigned char* src, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        int src_alpha = src[i + 3];
+        int src_inverse = MAX_ALPHA - src_alpha;
+        int dst_alpha = dst[i + 3];
+        int dst_inverse = MAX_ALPHA - dst_alpha;
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            int s = SRC_PREMULTIPLIED || channel == 3 ? src[i + channel] : Mul255Scalar(src[i + channel], src_alpha);
+            int d = dst[i + channel];
+            int result = 0;
+            if constexpr (MODE == BlendMode::OVER) {
+                result = s + Mul255Scalar(d, src_inverse);
+            } else if constexpr (MODE == BlendMode::IN) {
+                result = Mul255Scalar(s, dst_alpha);
+            } else if constexpr (MODE == BlendMode::OUT) {
+                result = Mul255Scalar(s, dst_inverse);
+            } else if constexpr (MODE == BlendMode::ATOP) {
+                result = Mul255Scalar(s, dst_alpha) + Mul255Scalar(d, src_inverse);
+            } else if constexpr (MODE == BlendMode::XOR) {
+                result = Mul255Scalar(s, dst_inverse) + Mul255Scalar(d, src_inverse);
+            } else if constexpr (MODE == BlendMode::MULTIPLY) {
+                result = Mul255Scalar(s, d) + Mul255Scalar(s, dst_inverse) + Mul255Scalar(d, src_inverse);
+            } else if constexpr (MODE == BlendMode::SCREEN) {
+                result = s + d - Mul255Scalar(s, d);
+            } else {
+                result = s + d;
+            }
+            dst[i + channel] = std::min(result, static_cast<int>(MAX_ALPHA));
+        }
+    }
+}
+
+void PremultiplyRowScalar(unsigned char* pixels, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        for(int channel = 0; channel < 3; ++channel) {
+            pixels[i + channel] = Mul255Scalar(pixels[i + channel], pixels[i + 3]);
+        }
+    }
+}
+
+// same arithmetic as InterpolateWide and InterpolateNarrow of the ResampleRow kernels
+inline int InterpolateWideScalar(int a, int b, int a_weight, int b_weight) {
+    return a * a_weight + b * b_weight;
+}
+
+inline int InterpolateNarrowScalar(int a, int b, int a_weight, int b_weight) {
+    int sum = (a * (a_weight << RESAMPLE_FRACTION_POW) >> 16) + (b * (b_weight << RESAMPLE_FRACTION_POW) >> 16);
+    return (sum + (1 << (RESAMPLE_FRACTION_POW - 1))) >> RESAMPLE_FRACTION_POW;
+}
+
+template <bool SRC_PREMULTIPLIED, bool PIXEL_ROWS>
+void ResampleRowScalar(unsigned char* out, const ResampleTaps& taps, int count) {
+    for(int i = 0; i < count; ++i) {
+        const unsigned char* pixels[2][2];
+        int row_weights[2];
+        for(int row = 0; row < 2; ++row) {
+            const unsigned char* source_row = taps.rows[row] + (PIXEL_ROWS ? taps.pixel_rows[row][i] : 0);
+            row_weights[row] = PIXEL_ROWS ? static_cast<int>(taps.pixel_row_weights[row][i] & 0xFFFF) : taps.row_weights[row];
+            for(int column = 0; column < 2; ++column) {
+                pixels[row][column] = source_row + taps.columns[column][i];
+            }
+        }
+        int column_weights[2] = {static_cast<int>(taps.column_weights[0][i] & 0xFFFF), static_cast<int>(taps.column_weights[1][i] & 0xFFFF)};
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            int columns[2];
+            for(int column = 0; column < 2; ++column) {
+                int values[2];
+                for(int row = 0; row < 2; ++row) {
+                    const unsigned char* pixel = pixels[row][column];
+                    values[row] = SRC_PREMULTIPLIED || channel == 3 ? pixel[channel] : Mul255Scalar(pixel[channel], pixel[3]);
+                }
+                columns[column] = InterpolateWideScalar(values[0], values[1], row_weights[0], row_weights[1]);
+            }
+            out[i * BYTES_PER_PIXEL + channel] = InterpolateNarrowScalar(columns[0], columns[1], column_weights[0], column_weights[1]);
+        }
+    }
+}
+
+} // namespace
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse41 {
+
+using Vec = __m128i;
+constexpr int PIXELS = 4;
+
+inline Vec Load(const unsigned char* p) { return _mm_loadu_si128(reinterpret_cast<const Vec*>(p)); }
+inline void Store(unsigned char* p, Vec v) { _mm_storeu_si128(reinterpret_cast<Vec*>(p), v); }
+
+inline Vec LoadPartial(const unsigned char* p, int count) {
+    alignas(16) unsigned char buffer[sizeof(Vec)] = {};
+    memcpy(buffer, p, count * BYTES_PER_PIXEL);
+    return Load(buffer);
+}
+
+inline void StorePartial(unsigned char* p, Vec v, int count) {
+    alignas(16) unsigned char buffer[sizeof(Vec)];
+    Store(buffer, v);
+    memcpy(p, buffer, count * BYTES_PER_PIXEL);
+}
+
+inline Vec Set8(char value) { return _mm_set1_epi8(value); }
+inline Vec Set16(short value) { return _mm_set1_epi16(value); }
+inline Vec Set32(int value) { return _mm_set1_epi32(value); }
+inline Vec Set64(long long value) { return _mm_set1_epi64x(value); }
+inline Vec UnpackLow8(Vec v) { return _mm_cvtepu8_epi16(v); }
+inline Vec UnpackHigh8(Vec v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+inline Vec Pack16(Vec low, Vec high) { return _mm_packus_epi16(low, high); }
+inline Vec Add16(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+inline Vec Add32(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+inline Vec Sub16(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+inline Vec Mul16(Vec a, Vec b) { return _mm_mullo_epi16(a, b); }
+inline Vec ShiftRight8(Vec v) { return _mm_srli_epi16(v, MAX_ALPHA_POW); }
+inline Vec ShiftRight7(Vec v) { return _mm_srli_epi16(v, RESAMPLE_FRACTION_POW); }
+inline Vec MulHigh16(Vec a, Vec b) { return _mm_mulhi_epu16(a, b); }
+inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec AddSaturate8(Vec a, Vec b) { return _mm_adds_epu8(a, b); }
+inline Vec SubSaturate8(Vec a, Vec b) { return _mm_subs_epu8(a, b); }
+inline Vec BroadcastAlpha16(Vec v) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+inline Vec UnpackLow32(Vec v) { return _mm_unpacklo_epi32(v, v); }
+inline Vec UnpackHigh32(Vec v) { return _mm_unpackhi_epi32(v, v); }
+
+// no gather instruction before AVX2
+inline Vec Gather32(const unsigned char* base, Vec offsets) {
+    alignas(16) int32_t indices[PIXELS];
+    alignas(16) int32_t values[PIXELS];
+    _mm_store_si128(reinterpret_cast<Vec*>(indices), offsets);
+    for(int i = 0; i < PIXELS; ++i) {
+        memcpy(&values[i], base + indices[i], sizeof(int32_t));
+    }
+    return _mm_load_si128(reinterpret_cast<const Vec*>(values));
+}
+
+#include "blend_kernels.inc"
+
+} // namespace sse41
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+
+using Vec = __m256i;
+constexpr int PIXELS = 8;
+
+inline Vec Load(const unsigned char* p) { return _mm256_loadu_si256(reinterpret_cast<const Vec*>(p)); }
+inline void Store(unsigned char* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<Vec*>(p), v); }
+
+inline Vec LoadPartial(const unsigned char* p, int count) {
+    alignas(32) unsigned char buffer[sizeof(Vec)] = {};
+    memcpy(buffer, p, count * BYTES_PER_PIXEL);
+    return Load(buffer);
+}
+
+inline void StorePartial(unsigned char* p, Vec v, int count) {
+    alignas(32) unsigned char buffer[sizeof(Vec)];
+    Store(buffer, v);
+    memcpy(p, buffer, count * BYTES_PER_PIXEL);
+}
+
+// unpack and pack both work inside 128-bit lanes, so the pixel order survives the round trip
+inline Vec Set8(char value) { return _mm256_set1_epi8(value); }
+inline Vec Set16(short value) { return _mm256_set1_epi16(value); }
+inline Vec Set32(int value) { return _mm256_set1_epi32(value); }
+inline Vec Set64(long long value) { return _mm256_set1_epi64x(value); }
+inline Vec UnpackLow8(Vec v) { return _mm256_unpacklo_epi8(v, _mm256_setzero_si256()); }
+inline Vec UnpackHigh8(Vec v) { return _mm256_unpackhi_epi8(v, _mm256_setzero_si256()); }
+inline Vec Pack16(Vec low, Vec high) { return _mm256_packus_epi16(low, high); }
+inline Vec Add16(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+inline Vec Add32(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+inline Vec Sub16(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+inline Vec Mul16(Vec a, Vec b) { return _mm256_mullo_epi16(a, b); }
+inline Vec ShiftRight8(Vec v) { return _mm256_srli_epi16(v, MAX_ALPHA_POW); }
+inline Vec ShiftRight7(Vec v) { return _mm256_srli_epi16(v, RESAMPLE_FRACTION_POW); }
+inline Vec MulHigh16(Vec a, Vec b) { return _mm256_mulhi_epu16(a, b); }
+inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec AddSaturate8(Vec a, Vec b) { return _mm256_adds_epu8(a, b); }
+inline Vec SubSaturate8(Vec a, Vec b) { return _mm256_subs_epu8(a, b); }
+inline Vec BroadcastAlpha16(Vec v) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+inline Vec UnpackLow32(Vec v) { return _mm256_unpacklo_epi32(v, v); }
+inline Vec UnpackHigh32(Vec v) { return _mm256_unpackhi_epi32(v, v); }
+inline Vec Gather32(const unsigned char* base, Vec offsets) {
+    return _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), offsets, 1);
+}
+
+#include "blend_kernels.inc"
+
+} // namespace avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+namespace avx512 {
+
+using Vec = __m512i;
+constexpr int PIXELS = 16;
+
+inline Vec Load(const unsigned char* p) { return _mm512_loadu_si512(p); }
+inline void Store(unsigned char* p, Vec v) { _mm512_storeu_si512(p, v); }
+
+inline Vec LoadPartial(const unsigned char* p, int count) {
+    return _mm512_maskz_loadu_epi32(static_cast<__mmask16>((1u << count) - 1), p);
+}
+
+inline void StorePartial(unsigned char* p, Vec v, int count) {
+    _mm512_mask_storeu_epi32(p, static_cast<__mmask16>((1u << count) - 1), v);
+}
+
+inline Vec Set8(char value) { return _mm512_set1_epi8(value); }
+inline Vec Set16(short value) { return _mm512_set1_epi16(value); }
+inline Vec Set32(int value) { return _mm512_set1_epi32(value); }
+inline Vec Set64(long long value) { return _mm512_set1_epi64(value); }
+inline Vec UnpackLow8(Vec v) { return _mm512_unpacklo_epi8(v, _mm512_setzero_si512()); }
+inline Vec UnpackHigh8(Vec v) { return _mm512_unpackhi_epi8(v, _mm512_setzero_si512()); }
+inline Vec Pack16(Vec low, Vec high) { return _mm512_packus_epi16(low, high); }
+inline Vec Add16(Vec a, Vec b) { return _mm512_add_epi16(a, b); }
+inline Vec Add32(Vec a, Vec b) { return _mm512_add_epi32(a, b); }
+inline Vec Sub16(Vec a, Vec b) { return _mm512_sub_epi16(a, b); }
+inline Vec Mul16(Vec a, Vec b) { return _mm512_mullo_epi16(a, b); }
+inline Vec ShiftRight8(Vec v) { return _mm512_srli_epi16(v, MAX_ALPHA_POW); }
+inline Vec ShiftRight7(Vec v) { return _mm512_srli_epi16(v, RESAMPLE_FRACTION_POW); }
+inline Vec MulHigh16(Vec a, Vec b) { return _mm512_mulhi_epu16(a, b); }
+inline Vec Or(Vec a, Vec b) { return _mm512_or_si512(a, b); }
+inline Vec AddSaturate8(Vec a, Vec b) { return _mm512_adds_epu8(a, b); }
+inline Vec SubSaturate8(Vec a, Vec b) { return _mm512_subs_epu8(a, b); }
+inline Vec BroadcastAlpha16(Vec v) {
+    return _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+inline Vec UnpackLow32(Vec v) { return _mm512_unpacklo_epi32(v, v); }
+inline Vec UnpackHigh32(Vec v) { return _mm512_unpackhi_epi32(v, v); }
+inline Vec Gather32(const unsigned char* base, Vec offsets) { return _mm512_i32gather_epi32(offsets, base, 1); }
+
+#include "blend_kernels.inc"
+
+} // namespace avx512
+#pragma GCC pop_options
+
+BlendKernel DetectBlendKernel() noexcept {
+    static const BlendKernel detected = [] {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512bw")) {
+            return BlendKernel::AVX512;
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            return BlendKernel::AVX2;
+        }
+        if(__builtin_cpu_supports("sse4.1")) {
+            return BlendKernel::SSE41;
+        }
+        return BlendKernel::SCALAR;
+    }();
+    return detected;
+}
+
+bool IsBlendKernelSupported(BlendKernel kernel) noexcept {
+    return kernel == BlendKernel::AUTO || kernel <= DetectBlendKernel();
+}
+
+const char* BlendKernelName(BlendKernel kernel) noexcept {
+    switch(kernel) {
+        case BlendKernel::AUTO:   return "auto";
+        case BlendKernel::SCALAR: return "scalar";
+        case BlendKernel::SSE41:  return "sse4.1";
+        case BlendKernel::AVX2:   return "avx2";
+        case BlendKernel::AVX512: return "avx512bw";
+    }
+    return "unknown";
+}
+
+template <BlendRounding ROUNDING, bool SRC_PREMULTIPLIED>
+BlendRowFn GetBlendRow(BlendKernel kernel) {
+    switch(kernel) {
+        case BlendKernel::AVX512: return avx512::BlendRow<ROUNDING, SRC_PREMULTIPLIED>;
+        case BlendKernel::AVX2:   return avx2::BlendRow<ROUNDING, SRC_PREMULTIPLIED>;
+        case BlendKernel::SSE41:  return sse41::BlendRow<ROUNDING, SRC_PREMULTIPLIED>;
+        default:                  return BlendRowScalar<ROUNDING, SRC_PREMULTIPLIED>;
+    }
+}
+
+template <BlendRounding ROUNDING>
+BlendRowFn GetBlendRow(BlendKernel kernel, bool src_premultiplied) {
+    return src_premultiplied ? GetBlendRow<ROUNDING, true>(kernel) : GetBlendRow<ROUNDING, false>(kernel);
+}
+
+template <BlendMode MODE, bool SRC_PREMULTIPLIED>
+BlendRowFn GetCompositeRow(BlendKernel kernel) {
+    switch(kernel) {
+        case BlendKernel::AVX512: return avx512::CompositeRow<MODE, SRC_PREMULTIPLIED>;
+        case BlendKernel::AVX2:   return avx2::CompositeRow<MODE, SRC_PREMULTIPLIED>;
+        case BlendKernel::SSE41:  return sse41::CompositeRow<MODE, SRC_PREMULTIPLIED>;
+        default:                  return CompositeRowScalar<MODE, SRC_PREMULTIPLIED>;
+    }
+}
+
+template <BlendMode MODE>
+BlendRowFn GetCompositeRow(BlendKernel kernel, bool src_premultiplied) {
+    return src_premultiplied ? GetCompositeRow<MODE, true>(kernel) : GetCompositeRow<MODE, false>(kernel);
+}
+
+namespace {
+
+BlendKernel ResolveKernel(BlendKernel kernel) {
+    if(kernel == BlendKernel::AUTO) {
+        kernel = DetectBlendKernel();
+    }
+    if(!IsBlendKernelSupported(kernel)) {
+        throw std::runtime_error("Requested blend kernel is not supported by this CPU!");
+    }
+    return kernel;
+}
+
+} // namespace
+
+BlendRowFn GetBlendRow(BlendKernel kernel, BlendRounding rounding, bool src_premultiplied) {
+    kernel = ResolveKernel(kernel);
+    return rounding == BlendRounding::SHIFT ? GetBlendRow<BlendRounding::SHIFT>(kernel, src_premultiplied)
+                                            : GetBlendRow<BlendRounding::DIVIDE_255>(kernel, src_premultiplied);
+}
+
+BlendRowFn GetCompositeRow(BlendKernel kernel, BlendMode mode, bool src_premultiplied) {
+    kernel = ResolveKernel(kernel);
+    switch(mode) {
+        case BlendMode::OVER:     return GetCompositeRow<BlendMode::OVER>(kernel, src_premultiplied);
+        case BlendMode::IN:       return GetCompositeRow<BlendMode::IN>(kernel, src_premultiplied);
+        case BlendMode::OUT:      return GetCompositeRow<BlendMode::OUT>(kernel, src_premultiplied);
+        case BlendMode::ATOP:     return GetCompositeRow<BlendMode::ATOP>(kernel, src_premultiplied);
+        case BlendMode::XOR:      return GetCompositeRow<BlendMode::XOR>(kernel, src_premultiplied);
+        case BlendMode::MULTIPLY: return GetCompositeRow<BlendMode::MULTIPLY>(kernel, src_premultiplied);
+        case BlendMode::SCREEN:   return GetCompositeRow<BlendMode::SCREEN>(kernel, src_premultiplied);
+        case BlendMode::ADD:      return GetCompositeRow<BlendMode::ADD>(kernel, src_premultiplied);
+        default:
+            throw std::runtime_error("SOURCE_OVER_OPAQUE has no composite kernel, use GetBlendRow!");
+    }
+}
+
+PixelRowFn GetPremultiplyRow(BlendKernel kernel) {
+    switch(ResolveKernel(kernel)) {
+        case BlendKernel::AVX512: return avx512::PremultiplyRow;
+        case BlendKernel::AVX2:   return avx2::PremultiplyRow;
+        case BlendKernel::SSE41:  return sse41::PremultiplyRow;
+        default:                  return PremultiplyRowScalar;
+    }
+}
+
+void UnpremultiplyRow(unsigned char* pixels, int count) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        int alpha = pixels[i + 3];
+        for(int channel = 0; channel < 3; ++channel) {
+            pixels[i + channel] = alpha ? std::min((pixels[i + channel] * MAX_ALPHA + alpha / 2) / alpha, static_cast<int>(MAX_ALPHA)) : 0;
+        }
+    }
+}
+
+PixelRowFn GetTransparentBlendRow(BlendKernel kernel, BlendRounding rounding) {
+    bool shift = rounding == BlendRounding::SHIFT;
+    switch(ResolveKernel(kernel)) {
+        case BlendKernel::AVX512:
+            return shift ? avx512::BlendTransparentRow<BlendRounding::SHIFT> : avx512::BlendTransparentRow<BlendRounding::DIVIDE_255>;
+        case BlendKernel::AVX2:
+            return shift ? avx2::BlendTransparentRow<BlendRounding::SHIFT> : avx2::BlendTransparentRow<BlendRounding::DIVIDE_255>;
+        case BlendKernel::SSE41:
+            return shift ? sse41::BlendTransparentRow<BlendRounding::SHIFT> : sse41::BlendTransparentRow<BlendRounding::DIVIDE_255>;
+        default:
+            return shift ? BlendTransparentRowScalar<BlendRounding::SHIFT> : BlendTransparentRowScalar<BlendRounding::DIVIDE_255>;
+    }
+}
+
+BlendRowFn GetOpaqueBlendRow(BlendKernel kernel, BlendRounding rounding) {
+    if(rounding == BlendRounding::DIVIDE_255) {
+        return CopyRow;
+    }
+    switch(ResolveKernel(kernel)) {
+        case BlendKernel::AVX512: return avx512::BlendOpaqueRow;
+        case BlendKernel::AVX2:   return avx2::BlendOpaqueRow;
+        case BlendKernel::SSE41:  return sse41::BlendOpaqueRow;
+        default:                  return BlendOpaqueRowScalar;
+    }
+}
+
+void CopyRow(unsigned char* dst, const unsigned char* src, int count) {
+    memcpy(dst, src, count * BYTES_PER_PIXEL);
+}
+
+template <bool SRC_PREMULTIPLIED, bool PIXEL_ROWS>
+ResampleRowFn GetResampleRow(BlendKernel kernel) {
+    switch(kernel) {
+        case BlendKernel::AVX512: return avx512::ResampleRow<SRC_PREMULTIPLIED, PIXEL_ROWS>;
+        case BlendKernel::AVX2:   return avx2::ResampleRow<SRC_PREMULTIPLIED, PIXEL_ROWS>;
+        case BlendKernel::SSE41:  return sse41::ResampleRow<SRC_PREMULTIPLIED, PIXEL_ROWS>;
+        default:                  return ResampleRowScalar<SRC_PREMULTIPLIED, PIXEL_ROWS>;
+    }
+}
+
+template <bool SRC_PREMULTIPLIED>
+ResampleRowFn GetResampleRow(BlendKernel kernel, bool pixel_rows) {
+    return pixel_rows ? GetResampleRow<SRC_PREMULTIPLIED, true>(kernel) : GetResampleRow<SRC_PREMULTIPLIED, false>(kernel);
+}
+
+ResampleRowFn GetResampleRow(BlendKernel kernel, bool src_premultiplied, bool pixel_rows) {
+    kernel = ResolveKernel(kernel);
+    return src_premultiplied ? GetResampleRow<true>(kernel, pixel_rows) : GetResampleRow<false>(kernel, pixel_rows);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+
+const int BYTES_PER_PIXEL = 4;
+const unsigned char MAX_ALPHA = 255;
+const int MAX_ALPHA_POW = 8;
+const int COMPOSE_BAND_BYTES = 256 * 1024;
+const int COMPOSE_TILE_WIDTH = 128; // 128 x 64 BGRA pixels = 32 KiB of destination per tile
+const int COMPOSE_TILE_HEIGHT = 64;
+const int RESAMPLE_WEIGHT_ONE = 256; // bilinear weights are fixed point with 8 fractional bits
+const int RESAMPLE_FRACTION_POW = 7; // fractional bits the second bilinear step keeps before rounding
+
+enum class BlendKernel {
+    AUTO,
+    SCALAR,
+    SSE41,
+    AVX2,
+    AVX512,
+};
+
+enum class BlendRounding {
+    SHIFT,      // (src * a + dst * (255 - a)) >> 8, matches the original SSE path bit for bit
+    DIVIDE_255, // exact round(x / 255)
+};
+
+enum class BlendMode {
+    SOURCE_OVER_OPAQUE, // the original operator: source over, destination alpha forced to MAX_ALPHA
+    // Porter-Duff and separable blend modes on premultiplied pixels, rounded exactly (x / 255).
+    // They keep the destination alpha, so the result can be composed again.
+    OVER,
+    IN,
+    OUT,
+    ATOP,
+    XOR,
+    MULTIPLY,
+    SCREEN,
+    ADD,
+};
+
+class ThreadPool;
+
+struct ComposeOptions {
+    BlendKernel kernel = BlendKernel::AUTO;
+    BlendRounding rounding = BlendRounding::SHIFT; // SOURCE_OVER_OPAQUE only
+    BlendMode mode = BlendMode::SOURCE_OVER_OPAQUE;
+    ThreadPool* pool = nullptr; // nullptr or a pool of size 1 blends serially on the calling thread
+    int band_rows = 0;          // rows per parallel task, 0 picks bands of about COMPOSE_BAND_BYTES
+    bool alpha_spans = false;   // skip/copy the transparent and opaque runs of the source's cached AlphaIndex;
+                                // pays off for sources with long runs, and costs time on small or soft-edged ones
+    int tile_width = 0;         // ComposeLayers tiles, 0 picks COMPOSE_TILE_WIDTH x COMPOSE_TILE_HEIGHT
+    int tile_height = 0;
+};
+
+// Blends `count` BGRA pixels of src over dst in place.
+using BlendRowFn = void (*)(unsigned char* dst, const unsigned char* src, int count);
+
+// Transforms `count` BGRA pixels in place.
+using PixelRowFn = void (*)(unsigned char* pixels, int count);
+
+// Bilinear taps of one output row. Output pixel i mixes the pixels at byte offsets columns[0][i] and
+// columns[1][i] of both source rows. Weights are out of RESAMPLE_WEIGHT_ONE; taps outside the source are
+// clamped to its edge and weighted 0. Per-pixel weights are repeated in both 16-bit halves of each element.
+struct ResampleTaps {
+    const unsigned char* rows[2] = {};
+    int row_weights[2] = {};
+    const int32_t* columns[2] = {};
+    const uint32_t* column_weights[2] = {};
+    // Only read by the per-pixel-row kernels (rotated or sheared overlays): pixel i reads its rows at
+    // rows[r] + pixel_rows[r][i], weighted pixel_row_weights[r][i].
+    const int32_t* pixel_rows[2] = {};
+    const uint32_t* pixel_row_weights[2] = {};
+};
+
+// Writes `count` resampled pixels as premultiplied BGRA; the source is BGRA, straight or premultiplied.
+using ResampleRowFn = void (*)(unsigned char* out, const ResampleTaps& taps, int count);
+
+// Best kernel supported by the running CPU (CPUID based, cached after the first call).
+BlendKernel DetectBlendKernel() noexcept;
+
+bool IsBlendKernelSupported(BlendKernel kernel) noexcept;
+
+const char* BlendKernelName(BlendKernel kernel) noexcept;
+
+// AUTO resolves to DetectBlendKernel(), unsupported kernels throw std::runtime_error.
+// A premultiplied source is blended as (src * 255 + dst * (255 - a)) scaled by the rounding.
+BlendRowFn GetBlendRow(BlendKernel kernel, BlendRounding rounding, bool src_premultiplied = false);
+
+// Composite kernel for a Porter-Duff/blend mode. The destination has to be premultiplied; a straight
+// source is premultiplied in registers, a premultiplied one saves that multiply on every channel.
+BlendRowFn GetCompositeRow(BlendKernel kernel, BlendMode mode, bool src_premultiplied);
+
+PixelRowFn GetPremultiplyRow(BlendKernel kernel);
+
+// Scalar only: it divides by alpha and is meant for the final conversion before saving.
+void UnpremultiplyRow(unsigned char* pixels, int count);
+
+// Exact equivalents of GetBlendRow(kernel, rounding) for a source alpha of 0 and of MAX_ALPHA
+// that skip the multiplies (the >> 8 rounding turns both into a saturating decrement).
+PixelRowFn GetTransparentBlendRow(BlendKernel kernel, BlendRounding rounding);
+BlendRowFn GetOpaqueBlendRow(BlendKernel kernel, BlendRounding rounding);
+
+void CopyRow(unsigned char* dst, const unsigned char* src, int count);
+
+// Vertical, then horizontal linear interpolation, each rounded to 8 bits.
+ResampleRowFn GetResampleRow(BlendKernel kernel, bool src_premultiplied, bool pixel_rows = false);
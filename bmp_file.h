@@ -0,0 +1,627 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alpha_index.h"
+#include "blend.h"
+#include "pixel_format.h"
+#include "resample.h"
+#include "thread_pool.h"
+
+const int BMP_FILE_SIZE_OFFSET = 0x2;
+const int BMP_FILE_OFFBITS_OFFSET = 0xA;
+const int BMP_FILE_WIDTH_OFFSET = 0x12;
+const int BMP_FILE_HEIGHT_OFFSET = 0x16;
+
+const uint16_t BMP_FILE_TYPE = 0x4D42; // "BM"
+const uint32_t BMP_FILE_HEADER_SIZE = 14;
+const uint32_t BMP_INFO_HEADER_SIZE = 40; // BITMAPINFOHEADER, the oldest header that is read
+const uint32_t BMP_V5_HEADER_SIZE = 124;
+const uint32_t BMP_V5_PIXELS_OFFSET = BMP_FILE_HEADER_SIZE + BMP_V5_HEADER_SIZE;
+
+const size_t MAP_COPY_BUFFER_SIZE = 1 << 20;
+
+enum class MapMode {
+    READ_ONLY,  // PROT_READ, the picture can only be used as a source
+    PRIVATE,    // copy-on-write, compositing never touches the file
+    SHARED,     // compositing writes straight into the file
+};
+
+
+
+#pragma pack(2)
+struct CIEXYZ {
+    uint32_t    x = 0;
+    uint32_t    y = 0;
+    uint32_t    z = 0;
+};
+
+struct CIEXYZTRIPLE {
+    CIEXYZ  ciexyzRed = {};
+    CIEXYZ  ciexyzGreen = {};
+    CIEXYZ  ciexyzBlue = {};
+};
+
+struct BMPHeader {
+    uint16_t        bfType              = 0;
+    uint32_t        bfSize              = 0;
+    uint16_t        bfReserved1         = 0;
+    uint16_t        bfReserved2         = 0;
+    uint32_t        bfOffBits           = 0;
+
+    uint32_t        bV5Size             = 0;
+    uint32_t        bV5Width            = 0;
+    uint32_t        bV5Height           = 0;
+    uint16_t        bV5Planes           = 0;
+    uint16_t        bV5BitCount         = 0;
+    uint32_t        biV5Compression     = 0;
+    uint32_t        bV5SizeImage        = 0;
+    uint32_t        bV5PelsPerMeter     = 0;
+    uint32_t        bV5YPelsPerMeter    = 0;
+    uint32_t        bV5ClrUsed          = 0;
+    uint32_t        bV5ClrImportant     = 0;
+    uint32_t        bV5RedMask          = 0;
+    uint32_t        bV5GreenMask        = 0;
+    uint32_t        bV5BlueMask         = 0;
+    uint32_t        bV5AlphaMask        = 0;
+    CIEXYZTRIPLE    bV5Endpoints        = {};
+    uint32_t        bV5GammaRed         = 0;
+    uint32_t        bV5GammaGreen       = 0;
+    uint32_t        bV5GammaBlue        = 0;
+    uint32_t        bV5Intent           = 0;
+    uint32_t        bV5ProfileData      = 0;
+    uint32_t        bV5ProfileSize      = 0;
+    uint32_t        bV5Reserved         = 0;
+
+};
+#pragma pack()
+
+// Copies the headers of a file of `size` bytes from its first min(size, sizeof(BMPHeader)) bytes at `data`.
+// Fields a shorter header does not have stay zero, so nothing is taken from the palette or the pixels behind
+// it. A BITMAPINFOHEADER is followed by its masks.
+inline BMPHeader ReadBMPHeader(const unsigned char* data, size_t size) {
+    BMPHeader header;
+    if(size < BMP_FILE_HEADER_SIZE + sizeof(header.bV5Size)) {
+        throw std::runtime_error("This file is not a BMP picture!");
+    }
+    memcpy(&header, data, std::min(size, sizeof(BMPHeader)));
+    size_t header_bytes = BMP_FILE_HEADER_SIZE + static_cast<size_t>(header.bV5Size);
+    if(header.bV5Size == BMP_INFO_HEADER_SIZE && header.biV5Compression == BMP_COMPRESSION_BITFIELDS) {
+        header_bytes += 3 * sizeof(uint32_t);
+    } else if(header.bV5Size == BMP_INFO_HEADER_SIZE && header.biV5Compression == BMP_COMPRESSION_ALPHABITFIELDS) {
+        header_bytes += 4 * sizeof(uint32_t);
+    }
+    if(header.bV5Size < BMP_INFO_HEADER_SIZE || header_bytes > size) {
+        throw std::runtime_error("This file is not a BMP picture!");
+    }
+    if(header_bytes < sizeof(BMPHeader)) {
+        memset(reinterpret_cast<unsigned char*>(&header) + header_bytes, 0, sizeof(BMPHeader) - header_bytes);
+    }
+    return header;
+}
+
+// Frees heap buffers with delete[] and memory mappings (mapped_size != 0) with munmap.
+class DataReleaser {
+    public:
+        size_t mapped_size = 0;
+
+        void operator()(unsigned char* data) {
+            if(mapped_size) {
+                munmap(data, mapped_size);
+            } else {
+                delete[] data;
+            }
+        }
+};
+
+class BMPFile;
+
+struct Layer {
+    const BMPFile* image = nullptr;
+    int x = 0;
+    int y = 0;
+    int z = 0; // lower z is composed first, equal z keeps the order of the list
+};
+
+
+class BMPFile {
+    private:
+        std::unique_ptr<unsigned char, DataReleaser> data_;
+        unsigned char* bitmap_ = nullptr;
+
+        int size_ = 0;
+        bool writable_ = true;
+        bool shared_ = false; // writes go straight to the file
+        BMPHeader header = {};
+
+        PixelLayout layout_ = {};
+        int height_ = 0;
+        int stride_ = 0;
+        bool top_down_ = false;
+
+        mutable std::shared_ptr<const AlphaIndex> alpha_index_;
+
+        class FileCloser {
+            public:
+                FileCloser() = default;
+                ~FileCloser() = default;
+                void operator()(FILE* file_pointer) {
+                    if(file_pointer) {
+                        fclose(file_pointer);
+                    }
+                }
+        };
+
+        void ReadHeader() {
+            header = ReadBMPHeader(data_.get(), size_);
+            layout_ = MakePixelLayout(header.bV5Size, header.bV5BitCount, header.biV5Compression,
+                                      header.bV5RedMask, header.bV5GreenMask, header.bV5BlueMask, header.bV5AlphaMask);
+            int32_t signed_height = static_cast<int32_t>(header.bV5Height);
+            height_ = signed_height < 0 ? -signed_height : signed_height;
+            top_down_ = signed_height < 0;
+            stride_ = layout_.Stride(Width());
+            if(header.bfOffBits + static_cast<uint64_t>(stride_) * height_ > static_cast<uint64_t>(size_)) {
+                throw std::runtime_error("This file is not a BMP picture!");
+            }
+            bitmap_ = data_.get() + header.bfOffBits;
+        }
+
+        void CheckWritable() const {
+            if(!writable_) {
+                throw std::runtime_error("Destination picture is mapped read-only!");
+            }
+        }
+
+        ResampleSource ResampleView() const noexcept {
+            ResampleSource source;
+            source.first_row = Row(0);
+            source.row_step = top_down_ ? -stride_ : stride_;
+            source.width = Width();
+            source.height = Height();
+            source.layout = layout_;
+            return source;
+        }
+
+        // Runs compose_rows(first, last) over destination rows [first_row, last_row), in bands on options.pool
+        // if there is one. Every row is blended by exactly one task, so the result does not depend on scheduling.
+        template <class ComposeRows>
+        static void ComposeBands(int first_row, int last_row, int row_pixels, const ComposeOptions& options, ComposeRows&& compose_rows) {
+            if(!options.pool || options.pool->Size() == 1) {
+                compose_rows(first_row, last_row);
+                return;
+            }
+            int band_rows = options.band_rows;
+            if(band_rows <= 0) {
+                band_rows = std::max(1, COMPOSE_BAND_BYTES / std::max(1, 2 * row_pixels * BYTES_PER_PIXEL));
+            }
+            int bands = (last_row - first_row + band_rows - 1) / band_rows;
+            options.pool->ParallelFor(bands, [&](int band) {
+                compose_rows(first_row + band * band_rows, std::min(last_row, first_row + (band + 1) * band_rows));
+            });
+        }
+
+        // ComposeAlpha without the bounds check: only the part of `other` inside this picture is blended.
+        void ComposeClipped(const BMPFile& other, int x, int y, const ComposeOptions& options) {
+            int left = std::max(0, -x);
+            int right = static_cast<int>(std::min<int64_t>(other.Width(), static_cast<int64_t>(Width()) - x));
+            int bottom = std::max(0, -y);
+            int top = static_cast<int>(std::min<int64_t>(other.Height(), static_cast<int64_t>(Height()) - y));
+            if(left >= right || bottom >= top) {
+                return;
+            }
+
+            InvalidateAlphaIndex();
+            RowBlender blend_row(layout_, other.layout_, options);
+            std::shared_ptr<const AlphaIndex> spans = options.alpha_spans ? other.AlphaSpans() : nullptr;
+            ComposeBands(y + bottom, y + top, right - left, options, [&](int first_row, int last_row) {
+                for(int row = first_row; row < last_row; ++row) {
+                    int i = row - y;
+                    if(spans) {
+                        blend_row.ComposeSpans(Row(row), x, other.Row(i), left, right, spans->RowBegin(i), spans->RowEnd(i));
+                    } else {
+                        blend_row(Pixel(x + left, row), other.Pixel(left, i), right - left);
+                    }
+                }
+            });
+        }
+
+        static void CopyFileContents(int source_fd, int destination_fd, size_t size) {
+            // copy_file_range keeps the copy inside the kernel (or shares extents on CoW filesystems)
+            size_t copied = 0;
+            while(copied < size) {
+                ssize_t chunk = copy_file_range(source_fd, nullptr, destination_fd, nullptr, size - copied, 0);
+                if(chunk <= 0) {
+                    break;
+                }
+                copied += chunk;
+            }
+            if(copied == size) {
+                return;
+            }
+
+            auto buffer = std::unique_ptr<unsigned char[]>(new unsigned char[MAP_COPY_BUFFER_SIZE]);
+            while(copied < size) {
+                ssize_t chunk = pread(source_fd, buffer.get(), std::min(size - copied, MAP_COPY_BUFFER_SIZE), copied);
+                if(chunk <= 0 || pwrite(destination_fd, buffer.get(), chunk, copied) != chunk) {
+                    throw std::runtime_error("Could not copy the picture!");
+                }
+                copied += chunk;
+            }
+        }
+
+    public:
+        BMPFile() noexcept : size_(0) {};
+        ~BMPFile() = default;
+
+        BMPFile(const BMPFile& other) = delete;
+
+        BMPFile& operator=(const BMPFile& other) = delete;
+
+        BMPFile(BMPFile&& other) noexcept {
+            swap(*this, other);
+        }
+
+        BMPFile& operator=(BMPFile&& other) noexcept {
+            swap(*this, other);
+            return *this;
+        }
+
+        BMPFile(const char* filename) {
+            auto bmp_file = std::unique_ptr<FILE, FileCloser>(fopen(filename, "r"), FileCloser());
+
+            if(!bmp_file.get()) {
+                throw std::runtime_error("This file does not exist!");
+            }
+            fseek(bmp_file.get(), 0, SEEK_END);
+            size_ = ftell(bmp_file.get());
+            fseek(bmp_file.get(), 0, SEEK_SET);
+
+            data_.reset(new unsigned char[size_]); // no value-initialization, fread overwrites every byte
+            if(fread(data_.get(), sizeof(unsigned char), size_, bmp_file.get()) != static_cast<size_t>(size_)) {
+                throw std::runtime_error("Could not read the picture!");
+            }
+
+            ReadHeader();
+        }
+
+        // New 32-bit BGRA picture (BI_BITFIELDS, bottom-up), all pixels transparent black.
+        static BMPFile Create(int width, int height) {
+            if(width <= 0 || height <= 0) {
+                throw std::runtime_error("Picture size must be positive!");
+            }
+            BMPHeader new_header;
+            new_header.bfType = BMP_FILE_TYPE;
+            new_header.bfOffBits = BMP_V5_PIXELS_OFFSET;
+            new_header.bV5Size = BMP_V5_HEADER_SIZE;
+            new_header.bV5Width = width;
+            new_header.bV5Height = height;
+            new_header.bV5Planes = 1;
+            new_header.bV5BitCount = BYTES_PER_PIXEL * 8;
+            new_header.biV5Compression = BMP_COMPRESSION_BITFIELDS;
+            new_header.bV5SizeImage = static_cast<uint32_t>(width) * height * BYTES_PER_PIXEL;
+            new_header.bV5RedMask = 0x00FF0000;
+            new_header.bV5GreenMask = 0x0000FF00;
+            new_header.bV5BlueMask = 0x000000FF;
+            new_header.bV5AlphaMask = 0xFF000000;
+            new_header.bfSize = new_header.bfOffBits + new_header.bV5SizeImage;
+
+            BMPFile file;
+            file.size_ = static_cast<int>(new_header.bfSize);
+            file.data_.reset(new unsigned char[file.size_]());
+            memcpy(file.data_.get(), &new_header, sizeof(BMPHeader));
+            file.ReadHeader();
+            return file;
+        }
+
+        // Maps the file instead of reading it: bitmap_ points straight into the page cache and pages are
+        // faulted in on first touch. PRIVATE mappings are copy-on-write, SHARED ones write through to the file.
+        static BMPFile Map(const char* filename, MapMode mode) {
+            int fd = open(filename, mode == MapMode::SHARED ? O_RDWR : O_RDONLY);
+            if(fd < 0) {
+                throw std::runtime_error("This file does not exist!");
+            }
+            struct stat file_stat = {};
+            if(fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(BMP_FILE_HEADER_SIZE)) {
+                close(fd);
+                throw std::runtime_error("This file is not a BMP picture!");
+            }
+
+            size_t size = file_stat.st_size;
+            int protection = mode == MapMode::READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+            void* mapping = mmap(nullptr, size, protection, mode == MapMode::SHARED ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(mapping == MAP_FAILED) {
+                throw std::runtime_error("Could not map the picture!");
+            }
+
+            BMPFile file;
+            file.data_ = std::unique_ptr<unsigned char, DataReleaser>(static_cast<unsigned char*>(mapping), DataReleaser{size});
+            file.size_ = static_cast<int>(size);
+            file.writable_ = mode != MapMode::READ_ONLY;
+            file.shared_ = mode == MapMode::SHARED;
+            file.ReadHeader();
+            return file;
+        }
+
+        // Copies source to destination and maps the copy shared, so compositing writes the output file in place.
+        // Throws std::runtime_error if both names refer to the same file, before anything is truncated.
+        static BMPFile MapCopy(const char* source, const char* destination) {
+            int source_fd = open(source, O_RDONLY);
+            if(source_fd < 0) {
+                throw std::runtime_error("This file does not exist!");
+            }
+            int destination_fd = open(destination, O_RDWR | O_CREAT, 0644);
+            if(destination_fd < 0) {
+                close(source_fd);
+                throw std::runtime_error("Could not create the output file!");
+            }
+
+            struct stat file_stat = {};
+            struct stat destination_stat = {};
+            try {
+                if(fstat(source_fd, &file_stat) != 0 || fstat(destination_fd, &destination_stat) != 0) {
+                    throw std::runtime_error("This file is not a BMP picture!");
+                }
+                if(file_stat.st_dev == destination_stat.st_dev && file_stat.st_ino == destination_stat.st_ino) {
+                    throw std::runtime_error("Source and destination must be different files!");
+                }
+                if(ftruncate(destination_fd, 0) != 0) {
+                    throw std::runtime_error("Could not create the output file!");
+                }
+                CopyFileContents(source_fd, destination_fd, file_stat.st_size);
+            } catch(...) {
+                close(source_fd);
+                close(destination_fd);
+                throw;
+            }
+            close(source_fd);
+            close(destination_fd);
+
+            return Map(destination, MapMode::SHARED);
+        }
+
+        // Flushes a SHARED mapping to disk; the kernel writes it back on its own otherwise.
+        void Sync() {
+            if(data_.get_deleter().mapped_size) {
+                msync(data_.get(), size_, MS_SYNC);
+            }
+        }
+
+        int Size() const noexcept {
+            return size_;
+        }
+
+        int Height() const noexcept {
+            return height_;
+        }
+
+        int Width() const noexcept {
+            return header.bV5Width;
+        }
+
+        const PixelLayout& Layout() const noexcept {
+            return layout_;
+        }
+
+        // Rows are counted from the bottom edge whatever order the file stores them in.
+        unsigned char* Row(int row) noexcept {
+            return bitmap_ + static_cast<ptrdiff_t>(top_down_ ? height_ - 1 - row : row) * stride_;
+        }
+
+        const unsigned char* Row(int row) const noexcept {
+            return bitmap_ + static_cast<ptrdiff_t>(top_down_ ? height_ - 1 - row : row) * stride_;
+        }
+
+        unsigned char* Pixel(int x, int row) noexcept {
+            return Row(row) + x * layout_.BytesPerPixel();
+        }
+
+        const unsigned char* Pixel(int x, int row) const noexcept {
+            return Row(row) + x * layout_.BytesPerPixel();
+        }
+
+        const unsigned char* Data() const noexcept {
+            return data_.get();
+        }
+
+        // Throws std::runtime_error for premultiplied pictures, BMP files hold straight colors.
+        void SaveToFile(const char* filename) {
+            if(layout_.premultiplied) {
+                throw std::runtime_error("Unpremultiply the picture before saving it!");
+            }
+            auto bmp_file = std::unique_ptr<FILE, FileCloser>(fopen(filename, "w"), FileCloser());
+            fwrite(data_.get(), sizeof(unsigned char), size_, bmp_file.get());
+        }
+
+        // Run-length index of the alpha channel, built on first use and shared by every later composite
+        // with this picture as the source. Premultiplying keeps it, compositing into the picture drops it.
+        std::shared_ptr<const AlphaIndex> AlphaSpans() const {
+            std::shared_ptr<const AlphaIndex> index = std::atomic_load(&alpha_index_);
+            if(!index) {
+                auto built = std::make_shared<AlphaIndex>();
+                for(int row = 0; row < Height(); ++row) {
+                    built->AddRow(Row(row), Width(), layout_);
+                }
+                index = built;
+                std::atomic_store(&alpha_index_, index);
+            }
+            return index;
+        }
+
+        // Call after changing pixels through Row() or Pixel().
+        void InvalidateAlphaIndex() noexcept {
+            std::atomic_store(&alpha_index_, std::shared_ptr<const AlphaIndex>());
+        }
+
+        bool Premultiplied() const noexcept {
+            return layout_.premultiplied;
+        }
+
+        // Stores colors multiplied by alpha, as the Porter-Duff modes expect. Premultiplying a sprite once
+        // saves a multiply per channel on every later composite of it. SHARED mappings are refused, the
+        // premultiplied colors would end up in the file.
+        void Premultiply(BlendKernel kernel = BlendKernel::AUTO) {
+            if(layout_.premultiplied) {
+                return;
+            }
+            CheckWritable();
+            if(shared_) {
+                throw std::runtime_error("A SHARED mapping can not be premultiplied!");
+            }
+            PixelRowFn premultiply_row = GetPremultiplyRow(kernel);
+            for(int row = 0; row < Height(); ++row) {
+                TransformRow(Row(row), Width(), layout_, premultiply_row, kernel);
+            }
+            layout_.premultiplied = true;
+        }
+
+        // Back to straight alpha, e.g. before SaveToFile: BMP viewers expect straight colors.
+        void Unpremultiply() {
+            if(!layout_.premultiplied) {
+                return;
+            }
+            CheckWritable();
+            for(int row = 0; row < Height(); ++row) {
+                TransformRow(Row(row), Width(), layout_, UnpremultiplyRow, BlendKernel::SCALAR);
+            }
+            layout_.premultiplied = false;
+        }
+
+        void ComposeAlpha(const BMPFile& other, int x, int y, const ComposeOptions& options = {}) {
+            CheckWritable();
+            if(x < 0 || y < 0 || x + other.Width() > Width() || y + other.Height() > Height()){
+                throw std::runtime_error("Argument picture must be smaller than dest!");
+            }
+            ComposeClipped(other, x, y, options);
+        }
+
+        // Composes `other` mapped by `transform` (position, scale or a whole affine matrix, see OverlayTransform),
+        // sampled bilinearly straight from its pixels in chunks of FORMAT_CHUNK_PIXELS that are blended while
+        // still in L1. Whatever falls outside this picture is clipped. A 1:1 transform at whole pixel offsets
+        // composes the pixels as they are, exactly like ComposeAlpha.
+        void ComposeTransformed(const BMPFile& other, const OverlayTransform& transform, const ComposeOptions& options = {}) {
+            CheckWritable();
+            if(transform.IntegerTranslation()) {
+                ComposeClipped(other, static_cast<int>(transform.x), static_cast<int>(transform.y), options);
+                return;
+            }
+
+            OverlayResampler resampler(other.ResampleView(), transform, Width(), Height(), options.kernel);
+            PixelLayout resampled;
+            resampled.premultiplied = true;
+            RowBlender blend_row(layout_, resampled, options);
+            InvalidateAlphaIndex();
+            ComposeBands(resampler.RowBegin(), resampler.RowEnd(), Width(), options, [&](int first_row, int last_row) {
+                alignas(64) unsigned char pixels[FORMAT_CHUNK_PIXELS * BYTES_PER_PIXEL];
+                for(int row = first_row; row < last_row; ++row) {
+                    std::pair<int, int> columns = resampler.Columns(row);
+                    for(int column = columns.first; column < columns.second; column += FORMAT_CHUNK_PIXELS) {
+                        int count = std::min(FORMAT_CHUNK_PIXELS, columns.second - column);
+                        resampler.Resample(pixels, row, column, count);
+                        blend_row(Pixel(column, row), pixels, count);
+                    }
+                }
+            });
+        }
+
+        // Same result as calling ComposeAlpha for every layer in z order, but the destination is walked
+        // tile by tile and every layer touching a tile is blended while that tile is still in cache.
+        void ComposeLayers(std::vector<Layer> layers, const ComposeOptions& options = {}) {
+            CheckWritable();
+            for(const Layer& layer : layers) {
+                if(!layer.image) {
+                    throw std::runtime_error("Layer has no image!");
+                }
+                if(layer.x < 0 || layer.y < 0 || layer.x + layer.image->Width() > Width() || layer.y + layer.image->Height() > Height()) {
+                    throw std::runtime_error("Argument picture must be smaller than dest!");
+                }
+            }
+            std::stable_sort(layers.begin(), layers.end(), [](const Layer& first, const Layer& second) {
+                return first.z < second.z;
+            });
+
+            int tile_width = options.tile_width > 0 ? options.tile_width : COMPOSE_TILE_WIDTH;
+            int tile_height = options.tile_height > 0 ? options.tile_height : COMPOSE_TILE_HEIGHT;
+            int tiles_x = (Width() + tile_width - 1) / tile_width;
+            int tiles_y = (Height() + tile_height - 1) / tile_height;
+            std::vector<std::vector<int>> tile_layers(tiles_x * tiles_y);
+            for(int index = 0; index < static_cast<int>(layers.size()); ++index) {
+                const Layer& layer = layers[index];
+                if(layer.image->Width() == 0 || layer.image->Height() == 0) {
+                    continue;
+                }
+                for(int tile_y = layer.y / tile_height; tile_y <= (layer.y + layer.image->Height() - 1) / tile_height; ++tile_y) {
+                    for(int tile_x = layer.x / tile_width; tile_x <= (layer.x + layer.image->Width() - 1) / tile_width; ++tile_x) {
+                        tile_layers[tile_y * tiles_x + tile_x].push_back(index);
+                    }
+                }
+            }
+
+            InvalidateAlphaIndex();
+            std::vector<RowBlender> blend_rows;
+            std::vector<std::shared_ptr<const AlphaIndex>> layer_spans;
+            for(const Layer& layer : layers) {
+                blend_rows.emplace_back(layout_, layer.image->layout_, options);
+                layer_spans.push_back(options.alpha_spans ? layer.image->AlphaSpans() : nullptr);
+            }
+            auto compose_tile = [&](int tile) {
+                int tile_left = (tile % tiles_x) * tile_width;
+                int tile_top = (tile / tiles_x) * tile_height;
+                int tile_right = std::min(Width(), tile_left + tile_width);
+                int tile_bottom = std::min(Height(), tile_top + tile_height);
+
+                for(int index : tile_layers[tile]) {
+                    const Layer& layer = layers[index];
+                    int left = std::max(tile_left, layer.x);
+                    int right = std::min(tile_right, layer.x + layer.image->Width());
+                    int top = std::max(tile_top, layer.y);
+                    int bottom = std::min(tile_bottom, layer.y + layer.image->Height());
+                    for(int row = top; row < bottom; ++row) {
+                        if(layer_spans[index]) {
+                            const AlphaIndex& spans = *layer_spans[index];
+                            blend_rows[index].ComposeSpans(Row(row), layer.x, layer.image->Row(row - layer.y), left - layer.x,
+                                                           right - layer.x, spans.RowBegin(row - layer.y), spans.RowEnd(row - layer.y));
+                        } else {
+                            blend_rows[index](Pixel(left, row), layer.image->Pixel(left - layer.x, row - layer.y), right - left);
+                        }
+                    }
+                }
+            };
+
+            // tiles are disjoint, so any tile order gives the same bytes
+            if(!options.pool || options.pool->Size() == 1) {
+                for(int tile = 0; tile < tiles_x * tiles_y; ++tile) {
+                    compose_tile(tile);
+                }
+            } else {
+                options.pool->ParallelFor(tiles_x * tiles_y, compose_tile);
+            }
+        }
+
+        friend void swap(BMPFile& first, BMPFile& second) noexcept {
+            std::swap(first.data_, second.data_);
+            std::swap(first.size_, second.size_);
+            std::swap(first.writable_, second.writable_);
+            std::swap(first.shared_, second.shared_);
+            std::swap(first.header, second.header);
+            std::swap(first.bitmap_, second.bitmap_);
+            std::swap(first.layout_, second.layout_);
+            std::swap(first.height_, second.height_);
+            std::swap(first.stride_, second.stride_);
+            std::swap(first.top_down_, second.top_down_);
+            std::swap(first.alpha_index_, second.alpha_index_);
+        }
+    
+};
@@ -0,0 +1,374 @@
+#include "pixel_format.h"
+
+#include "alpha_index.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <immintrin.h>
+
+namespace {
+
+using ConvertRowFn = RowBlender::ConvertRowFn;
+
+void DecodeBGR24Scalar(unsigned char* to, const unsigned char* from, int count, const PixelLayout&) {
+    for(int i = 0; i < count; ++i) {
+        to[4 * i + 0] = from[3 * i + 0];
+        to[4 * i + 1] = from[3 * i + 1];
+        to[4 * i + 2] = from[3 * i + 2];
+        to[4 * i + 3] = MAX_ALPHA;
+    }
+}
+
+void EncodeBGR24Scalar(unsigned char* to, const unsigned char* from, int count, const PixelLayout&) {
+    for(int i = 0; i < count; ++i) {
+        to[3 * i + 0] = from[4 * i + 0];
+        to[3 * i + 1] = from[4 * i + 1];
+        to[3 * i + 2] = from[4 * i + 2];
+    }
+}
+
+void DecodeMasked32Scalar(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            unsigned char byte = layout.channel_bytes[channel];
+            to[i + channel] = byte == NO_CHANNEL ? MAX_ALPHA : from[i + byte];
+        }
+    }
+}
+
+void EncodeMasked32Scalar(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    for(int i = 0; i < count * BYTES_PER_PIXEL; i += BYTES_PER_PIXEL) {
+        unsigned char pixel[BYTES_PER_PIXEL] = {};
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            if(layout.channel_bytes[channel] != NO_CHANNEL) {
+                pixel[layout.channel_bytes[channel]] = from[i + channel];
+            }
+        }
+        std::copy(pixel, pixel + BYTES_PER_PIXEL, to + i);
+    }
+}
+
+// pshufb masks for 4 pixels, the AVX2 versions repeat them in both 128-bit lanes
+const char DECODE_BGR24_MASK[16] = {0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128};
+const char ENCODE_BGR24_MASK[16] = {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128};
+
+void MakeMaskedShuffles(const PixelLayout& layout, char (&decode)[16], char (&encode)[16]) {
+    std::fill(encode, encode + 16, -128);
+    for(int pixel = 0; pixel < 4; ++pixel) {
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            unsigned char byte = layout.channel_bytes[channel];
+            decode[4 * pixel + channel] = byte == NO_CHANNEL ? -128 : 4 * pixel + byte;
+            if(byte != NO_CHANNEL) {
+                encode[4 * pixel + byte] = 4 * pixel + channel;
+            }
+        }
+    }
+}
+
+int MissingAlpha(const PixelLayout& layout) {
+    return layout.channel_bytes[3] == NO_CHANNEL ? static_cast<int>(0xFF000000u) : 0;
+}
+
+} // namespace
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse41 {
+
+// 16-byte loads and stores of packed 24-bit pixels touch 4 bytes past the 4 pixels they convert,
+// so the vector loops stop 2 pixels early and leave the rest to the scalar converters.
+void DecodeBGR24(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(DECODE_BGR24_MASK));
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    int i = 0;
+    for(; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + 3 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 4 * i), _mm_or_si128(_mm_shuffle_epi8(pixels, mask), alpha));
+    }
+    DecodeBGR24Scalar(to + 4 * i, from + 3 * i, count - i, layout);
+}
+
+void EncodeBGR24(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ENCODE_BGR24_MASK));
+    int i = 0;
+    for(; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + 4 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 3 * i), _mm_shuffle_epi8(pixels, mask));
+    }
+    EncodeBGR24Scalar(to + 3 * i, from + 4 * i, count - i, layout);
+}
+
+void DecodeMasked32(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    char decode[16], encode[16];
+    MakeMaskedShuffles(layout, decode, encode);
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(decode));
+    const __m128i alpha = _mm_set1_epi32(MissingAlpha(layout));
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + 4 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 4 * i), _mm_or_si128(_mm_shuffle_epi8(pixels, mask), alpha));
+    }
+    DecodeMasked32Scalar(to + 4 * i, from + 4 * i, count - i, layout);
+}
+
+void EncodeMasked32(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    char decode[16], encode[16];
+    MakeMaskedShuffles(layout, decode, encode);
+    const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(encode));
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + 4 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 4 * i), _mm_shuffle_epi8(pixels, mask));
+    }
+    EncodeMasked32Scalar(to + 4 * i, from + 4 * i, count - i, layout);
+}
+
+} // namespace sse41
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+
+inline __m256i BroadcastMask(const char* mask) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask)));
+}
+
+// the upper lane starts 12 bytes in, so 8 pixels touch 28 bytes: stop 2 pixels early as in sse41
+void DecodeBGR24(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    const __m256i mask = BroadcastMask(DECODE_BGR24_MASK);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    int i = 0;
+    for(; i + 10 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu2_m128i(reinterpret_cast<const __m128i*>(from + 3 * i + 12),
+                                             reinterpret_cast<const __m128i*>(from + 3 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + 4 * i), _mm256_or_si256(_mm256_shuffle_epi8(pixels, mask), alpha));
+    }
+    sse41::DecodeBGR24(to + 4 * i, from + 3 * i, count - i, layout);
+}
+
+void EncodeBGR24(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    const __m256i mask = BroadcastMask(ENCODE_BGR24_MASK);
+    int i = 0;
+    for(; i + 10 <= count; i += 8) {
+        __m256i pixels = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + 4 * i)), mask);
+        // the low lane store leaves 4 zero bytes that the high lane store overwrites
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 3 * i), _mm256_castsi256_si128(pixels));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + 3 * i + 12), _mm256_extracti128_si256(pixels, 1));
+    }
+    sse41::EncodeBGR24(to + 3 * i, from + 4 * i, count - i, layout);
+}
+
+void DecodeMasked32(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    char decode[16], encode[16];
+    MakeMaskedShuffles(layout, decode, encode);
+    const __m256i mask = BroadcastMask(decode);
+    const __m256i alpha = _mm256_set1_epi32(MissingAlpha(layout));
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + 4 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + 4 * i), _mm256_or_si256(_mm256_shuffle_epi8(pixels, mask), alpha));
+    }
+    sse41::DecodeMasked32(to + 4 * i, from + 4 * i, count - i, layout);
+}
+
+void EncodeMasked32(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout) {
+    char decode[16], encode[16];
+    MakeMaskedShuffles(layout, decode, encode);
+    const __m256i mask = BroadcastMask(encode);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + 4 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + 4 * i), _mm256_shuffle_epi8(pixels, mask));
+    }
+    sse41::EncodeMasked32(to + 4 * i, from + 4 * i, count - i, layout);
+}
+
+} // namespace avx2
+#pragma GCC pop_options
+
+namespace {
+
+struct RowConverters {
+    ConvertRowFn decode;
+    ConvertRowFn encode;
+};
+
+RowConverters GetRowConverters(PixelFormat format, BlendKernel kernel) {
+    if(format == PixelFormat::BGRA32) {
+        return {nullptr, nullptr};
+    }
+    bool bgr24 = format == PixelFormat::BGR24;
+    switch(kernel) {
+        case BlendKernel::AVX512:
+        case BlendKernel::AVX2:
+            return bgr24 ? RowConverters{avx2::DecodeBGR24, avx2::EncodeBGR24} : RowConverters{avx2::DecodeMasked32, avx2::EncodeMasked32};
+        case BlendKernel::SSE41:
+            return bgr24 ? RowConverters{sse41::DecodeBGR24, sse41::EncodeBGR24} : RowConverters{sse41::DecodeMasked32, sse41::EncodeMasked32};
+        default:
+            return bgr24 ? RowConverters{DecodeBGR24Scalar, EncodeBGR24Scalar} : RowConverters{DecodeMasked32Scalar, EncodeMasked32Scalar};
+    }
+}
+
+template <PixelFormat DST, PixelFormat SRC>
+void ComposeRow(const RowBlender& blender, unsigned char* dst, const unsigned char* src, int count) {
+    if constexpr (DST == PixelFormat::BGRA32 && SRC == PixelFormat::BGRA32) {
+        blender.blend_row(dst, src, count);
+    } else {
+        alignas(64) unsigned char dst_pixels[FORMAT_CHUNK_PIXELS * BYTES_PER_PIXEL];
+        alignas(64) unsigned char src_pixels[FORMAT_CHUNK_PIXELS * BYTES_PER_PIXEL];
+        for(int done = 0; done < count; done += FORMAT_CHUNK_PIXELS) {
+            int chunk = std::min(FORMAT_CHUNK_PIXELS, count - done);
+            unsigned char* dst_chunk = dst + done * BytesPerPixel(DST);
+            const unsigned char* src_chunk = src + done * BytesPerPixel(SRC);
+
+            const unsigned char* blend_src = src_chunk;
+            if constexpr (SRC != PixelFormat::BGRA32) {
+                blender.decode_src(src_pixels, src_chunk, chunk, blender.src_layout);
+                blend_src = src_pixels;
+            }
+            if constexpr (DST != PixelFormat::BGRA32) {
+                blender.decode_dst(dst_pixels, dst_chunk, chunk, blender.dst_layout);
+                blender.blend_row(dst_pixels, blend_src, chunk);
+                blender.encode_dst(dst_chunk, dst_pixels, chunk, blender.dst_layout);
+            } else {
+                blender.blend_row(dst_chunk, blend_src, chunk);
+            }
+        }
+    }
+}
+
+template <PixelFormat DST>
+RowBlender::ComposeRowFn GetComposeRow(PixelFormat src) {
+    switch(src) {
+        case PixelFormat::BGR24:    return ComposeRow<DST, PixelFormat::BGR24>;
+        case PixelFormat::MASKED32: return ComposeRow<DST, PixelFormat::MASKED32>;
+        default:                    return ComposeRow<DST, PixelFormat::BGRA32>;
+    }
+}
+
+// byte index of an 8-bit mask, -1 if the mask is not a whole byte
+int MaskByte(uint32_t mask) {
+    for(int byte = 0; byte < 4; ++byte) {
+        if(mask == 0xFFu << (8 * byte)) {
+            return byte;
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+PixelLayout MakePixelLayout(uint32_t header_size, uint16_t bit_count, uint32_t compression,
+                            uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, uint32_t alpha_mask) {
+    PixelLayout layout;
+    if(compression == BMP_COMPRESSION_RGB) {
+        if(bit_count == 24) {
+            layout.format = PixelFormat::BGR24;
+            layout.channel_bytes[3] = NO_CHANNEL;
+            return layout;
+        }
+        if(bit_count == 32) {
+            return layout; // the fourth byte has always been treated as alpha here
+        }
+        throw std::runtime_error("Only 24-bit and 32-bit pictures are supported!");
+    }
+    if((compression != BMP_COMPRESSION_BITFIELDS && compression != BMP_COMPRESSION_ALPHABITFIELDS) || bit_count != 32) {
+        throw std::runtime_error("Unsupported BMP compression!");
+    }
+
+    if(header_size < BMP_V3_HEADER_SIZE && compression != BMP_COMPRESSION_ALPHABITFIELDS) {
+        alpha_mask = 0; // that field belongs to the palette or the pixels
+    }
+    int bytes[4] = {MaskByte(blue_mask), MaskByte(green_mask), MaskByte(red_mask), alpha_mask ? MaskByte(alpha_mask) : NO_CHANNEL};
+    for(int channel = 0; channel < 4; ++channel) {
+        bool used_twice = std::count(bytes, bytes + 4, bytes[channel]) > 1 && bytes[channel] != NO_CHANNEL;
+        if(bytes[channel] < 0 || used_twice) {
+            throw std::runtime_error("Only byte-aligned 8-bit channel masks are supported!");
+        }
+        layout.channel_bytes[channel] = static_cast<unsigned char>(bytes[channel]);
+    }
+    if(bytes[0] != 0 || bytes[1] != 1 || bytes[2] != 2 || bytes[3] != 3) {
+        layout.format = PixelFormat::MASKED32;
+    }
+    return layout;
+}
+
+void TransformRow(unsigned char* pixels, int count, const PixelLayout& layout, PixelRowFn transform, BlendKernel kernel) {
+    if(layout.format == PixelFormat::BGRA32) {
+        transform(pixels, count);
+        return;
+    }
+    RowConverters converters = GetRowConverters(layout.format, kernel == BlendKernel::AUTO ? DetectBlendKernel() : kernel);
+    alignas(64) unsigned char canonical[FORMAT_CHUNK_PIXELS * BYTES_PER_PIXEL];
+    for(int done = 0; done < count; done += FORMAT_CHUNK_PIXELS) {
+        int chunk = std::min(FORMAT_CHUNK_PIXELS, count - done);
+        unsigned char* stored = pixels + done * layout.BytesPerPixel();
+        converters.decode(canonical, stored, chunk, layout);
+        transform(canonical, chunk);
+        converters.encode(stored, canonical, chunk, layout);
+    }
+}
+
+RowBlender::RowBlender(const PixelLayout& dst, const PixelLayout& src, const ComposeOptions& options)
+    : dst_layout(dst), src_layout(src) {
+    BlendKernel kernel = options.kernel == BlendKernel::AUTO ? DetectBlendKernel() : options.kernel;
+    if(options.mode == BlendMode::SOURCE_OVER_OPAQUE) {
+        // alpha 0 and MAX_ALPHA pixels are the same straight or premultiplied, so the span shortcuts still apply
+        blend_row = GetBlendRow(kernel, options.rounding, src.premultiplied);
+        transparent_row = GetTransparentBlendRow(kernel, options.rounding);
+        opaque_row = GetOpaqueBlendRow(kernel, options.rounding);
+    } else {
+        // without an alpha channel straight and premultiplied pixels are the same
+        if(!dst.premultiplied && dst.HasAlpha()) {
+            throw std::runtime_error("Porter-Duff modes need a premultiplied destination!");
+        }
+        blend_row = GetCompositeRow(kernel, options.mode, src.premultiplied || !src.HasAlpha());
+        // a transparent source pixel is all zeros once premultiplied, which these modes add nothing for
+        skip_transparent = options.mode != BlendMode::IN && options.mode != BlendMode::OUT;
+        if(options.mode == BlendMode::OVER) {
+            opaque_row = CopyRow;
+        }
+    }
+
+    RowConverters dst_converters = GetRowConverters(dst.format, kernel);
+    decode_dst = dst_converters.decode;
+    encode_dst = dst_converters.encode;
+    decode_src = GetRowConverters(src.format, kernel).decode;
+
+    switch(dst.format) {
+        case PixelFormat::BGR24:    compose_row = GetComposeRow<PixelFormat::BGR24>(src.format); break;
+        case PixelFormat::MASKED32: compose_row = GetComposeRow<PixelFormat::MASKED32>(src.format); break;
+        default:                    compose_row = GetComposeRow<PixelFormat::BGRA32>(src.format); break;
+    }
+}
+
+void RowBlender::ComposeSpans(unsigned char* dst_row, int dst_column, const unsigned char* src, int begin, int end,
+                              const AlphaSpan* first, const AlphaSpan* last) const {
+    bool canonical_dst = dst_layout.format == PixelFormat::BGRA32;
+    bool canonical = canonical_dst && src_layout.format == PixelFormat::BGRA32;
+    int dst_bytes = dst_layout.BytesPerPixel();
+    int src_bytes = src_layout.BytesPerPixel();
+
+    first = std::upper_bound(first, last, begin, [](int column, const AlphaSpan& span) {
+        return column < span.end;
+    });
+    for(const AlphaSpan* span = first; span != last && span->begin < end; ++span) {
+        int from = std::max(begin, span->begin);
+        int count = std::min(end, span->end) - from;
+        unsigned char* dst_pixels = dst_row + static_cast<ptrdiff_t>(dst_column + from) * dst_bytes;
+        const unsigned char* src_pixels = src + static_cast<ptrdiff_t>(from) * src_bytes;
+
+        if(span->kind == SpanKind::TRANSPARENT && skip_transparent) {
+            continue;
+        }
+        if(span->kind == SpanKind::TRANSPARENT && transparent_row && canonical_dst) {
+            transparent_row(dst_pixels, count);
+        } else if(span->kind == SpanKind::OPAQUE && opaque_row && canonical) {
+            opaque_row(dst_pixels, src_pixels, count);
+        } else {
+            compose_row(*this, dst_pixels, src_pixels, count);
+        }
+    }
+}
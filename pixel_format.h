@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+#include "blend.h"
+
+const uint32_t BMP_COMPRESSION_RGB = 0;
+const uint32_t BMP_COMPRESSION_BITFIELDS = 3;
+const uint32_t BMP_COMPRESSION_ALPHABITFIELDS = 6;
+const uint32_t BMP_V3_HEADER_SIZE = 56; // the first info header with an alpha mask
+
+// Pixels are converted in chunks of this many pixels into 64-byte aligned stack buffers (4 KiB each).
+const int FORMAT_CHUNK_PIXELS = 1024;
+const unsigned char NO_CHANNEL = 0xFF;
+
+enum class PixelFormat {
+    BGRA32,   // canonical layout, blended in place without any conversion
+    BGR24,    // no alpha, rows padded to 4 bytes
+    MASKED32, // BI_BITFIELDS with byte-aligned 8-bit masks in any order
+};
+
+constexpr int BytesPerPixel(PixelFormat format) {
+    return format == PixelFormat::BGR24 ? 3 : 4;
+}
+
+struct PixelLayout {
+    PixelFormat format = PixelFormat::BGRA32;
+    // byte of B, G, R and A inside a stored pixel, NO_CHANNEL for a missing alpha (read as opaque)
+    unsigned char channel_bytes[4] = {0, 1, 2, 3};
+    bool premultiplied = false;
+
+    bool HasAlpha() const noexcept {
+        return channel_bytes[3] != NO_CHANNEL;
+    }
+
+    int BytesPerPixel() const noexcept {
+        return ::BytesPerPixel(format);
+    }
+
+    // stored rows are padded to a multiple of 4 bytes
+    int Stride(int width) const noexcept {
+        return (width * BytesPerPixel() + 3) & ~3;
+    }
+};
+
+// Throws std::runtime_error for layouts that can not be blended (palettes, RLE, 16 bpp, odd masks).
+// alpha_mask is only read from headers of at least BMP_V3_HEADER_SIZE bytes or with BI_ALPHABITFIELDS.
+PixelLayout MakePixelLayout(uint32_t header_size, uint16_t bit_count, uint32_t compression,
+                            uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, uint32_t alpha_mask);
+
+struct AlphaSpan;
+
+// Applies a BGRA transform to `count` stored pixels in place, converting through the chunk buffers if needed.
+void TransformRow(unsigned char* pixels, int count, const PixelLayout& layout, PixelRowFn transform, BlendKernel kernel);
+
+// Composes `count` stored pixels of src over dst, both in their own layouts. Pictures that are not
+// BGRA32 go through the canonical chunk buffers; BGRA32 on both sides calls the blend kernel directly.
+// The conversion is picked once per compose from a table of instantiations, never per pixel.
+struct RowBlender {
+    using ConvertRowFn = void (*)(unsigned char* to, const unsigned char* from, int count, const PixelLayout& layout);
+    using ComposeRowFn = void (*)(const RowBlender& blender, unsigned char* dst, const unsigned char* src, int count);
+
+    PixelLayout dst_layout;
+    PixelLayout src_layout;
+    BlendRowFn blend_row = nullptr;
+    ConvertRowFn decode_dst = nullptr;
+    ConvertRowFn encode_dst = nullptr;
+    ConvertRowFn decode_src = nullptr;
+    ComposeRowFn compose_row = nullptr;
+
+    // Span fast paths, each one gives exactly the bytes compose_row would.
+    bool skip_transparent = false;        // compose_row leaves dst untouched under alpha 0
+    PixelRowFn transparent_row = nullptr; // cheaper equivalent under alpha 0, BGRA32 destination only
+    BlendRowFn opaque_row = nullptr;      // cheaper equivalent under alpha MAX_ALPHA, BGRA32 on both sides
+
+    // Throws std::runtime_error if options.mode does not match the premultiplication of the layouts.
+    RowBlender(const PixelLayout& dst, const PixelLayout& src, const ComposeOptions& options);
+
+    void operator()(unsigned char* dst, const unsigned char* src, int count) const {
+        compose_row(*this, dst, src, count);
+    }
+
+    // Composes columns [begin, end) of a source row described by the AlphaIndex spans [first, last).
+    // dst_row and src point at column 0 of their rows; source column c lands on destination column dst_column + c.
+    void ComposeSpans(unsigned char* dst_row, int dst_column, const unsigned char* src, int begin, int end,
+                      const AlphaSpan* first, const AlphaSpan* last) const;
+};
@@ -0,0 +1,284 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+inline int Mul255Scalar(int a, int b) {
+    int product = a * b + (1 << (MAX_ALPHA_POW - 1));
+    return (product + (product >> MAX_ALPHA_POW)) >> MAX_ALPHA_POW;
+}
+
+// same arithmetic as InterpolateWide and InterpolateNarrow of the ResampleRow kernels
+inline int InterpolateWideScalar(int a, int b, int a_weight, int b_weight) {
+    return a * a_weight + b * b_weight;
+}
+
+inline int InterpolateNarrowScalar(int a, int b, int a_weight, int b_weight) {
+    int sum = (a * (a_weight << RESAMPLE_FRACTION_POW) >> 16) + (b * (b_weight << RESAMPLE_FRACTION_POW) >> 16);
+    return (sum + (1 << (RESAMPLE_FRACTION_POW - 1))) >> RESAMPLE_FRACTION_POW;
+}
+
+void LoadPremultiplied(const unsigned char* pixel, const PixelLayout& layout, int (&bgra)[BYTES_PER_PIXEL]) {
+    for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+        unsigned char byte = layout.channel_bytes[channel];
+        bgra[channel] = byte == NO_CHANNEL ? MAX_ALPHA : pixel[byte];
+    }
+    if(!layout.premultiplied) {
+        for(int channel = 0; channel < 3; ++channel) {
+            bgra[channel] = Mul255Scalar(bgra[channel], bgra[3]);
+        }
+    }
+}
+
+int ClampToInt(double value) {
+    return static_cast<int>(std::clamp(value, -1.0, static_cast<double>(std::numeric_limits<int>::max())));
+}
+
+// Narrows [begin, end) to the pixels c with low < c + 0.5 < high, widened by a pixel on both sides;
+// the caller trims the ends with the exact tap test, so rounding here only costs a few extra checks.
+void CoveredRange(double low, double high, int& begin, int& end) {
+    begin = std::max(begin, ClampToInt(std::floor(low - 0.5) - 1));
+    end = std::min(end, ClampToInt(std::ceil(high - 0.5) + 1));
+}
+
+} // namespace
+
+bool OverlayTransform::IntegerTranslation() const noexcept {
+    return xx == 1.0f && xy == 0.0f && yx == 0.0f && yy == 1.0f && std::floor(x) == x && std::floor(y) == y &&
+           std::fabs(x) < std::numeric_limits<int>::max() && std::fabs(y) < std::numeric_limits<int>::max();
+}
+
+OverlayResampler::AxisTaps OverlayResampler::MakeTaps(double position, int size) {
+    AxisTaps taps;
+    // pixel centers sit at i + 0.5, anything beyond a pixel outside the picture has no taps at all
+    double sample = position - 0.5;
+    if(!(sample > -1.0 && sample < size)) {
+        return taps;
+    }
+    double first = std::floor(sample);
+    int index = static_cast<int>(first);
+    int weight = static_cast<int>((sample - first) * RESAMPLE_WEIGHT_ONE + 0.5); // the fraction is never negative
+    if(weight == RESAMPLE_WEIGHT_ONE) {
+        ++index;
+        weight = 0;
+    }
+    int weights[2] = {RESAMPLE_WEIGHT_ONE - weight, weight};
+    for(int tap = 0; tap < 2; ++tap) {
+        int at = index + tap;
+        taps.index[tap] = std::clamp(at, 0, size - 1);
+        taps.weight[tap] = at >= 0 && at < size ? weights[tap] : 0;
+    }
+    return taps;
+}
+
+OverlayResampler::AxisTaps OverlayResampler::ColumnTaps(int column, int row) const {
+    double x = column + 0.5 - offset_[0];
+    double y = row + 0.5 - offset_[1];
+    return MakeTaps(inverse_[0] * x + inverse_[1] * y, source_.width);
+}
+
+OverlayResampler::AxisTaps OverlayResampler::RowTaps(int column, int row) const {
+    double x = column + 0.5 - offset_[0];
+    double y = row + 0.5 - offset_[1];
+    return MakeTaps(inverse_[2] * x + inverse_[3] * y, source_.height);
+}
+
+bool OverlayResampler::Covered(int column, int row) const {
+    return ColumnTaps(column, row).Covered() && RowTaps(column, row).Covered();
+}
+
+void OverlayResampler::SamplePixel(unsigned char* out, const AxisTaps& columns, const AxisTaps& rows) const {
+    int bytes = source_.layout.BytesPerPixel();
+    int interpolated[2][BYTES_PER_PIXEL];
+    for(int column = 0; column < 2; ++column) {
+        int values[2][BYTES_PER_PIXEL];
+        for(int row = 0; row < 2; ++row) {
+            const unsigned char* pixel = source_.first_row + rows.index[row] * source_.row_step + columns.index[column] * bytes;
+            LoadPremultiplied(pixel, source_.layout, values[row]);
+        }
+        for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+            interpolated[column][channel] = InterpolateWideScalar(values[0][channel], values[1][channel], rows.weight[0], rows.weight[1]);
+        }
+    }
+    for(int channel = 0; channel < BYTES_PER_PIXEL; ++channel) {
+        out[channel] = InterpolateNarrowScalar(interpolated[0][channel], interpolated[1][channel], columns.weight[0], columns.weight[1]);
+    }
+}
+
+OverlayResampler::OverlayResampler(const ResampleSource& source, const OverlayTransform& transform, int dst_width, int dst_height,
+                                   BlendKernel kernel)
+    : source_(source), dst_width_(dst_width) {
+    double determinant = static_cast<double>(transform.xx) * transform.yy - static_cast<double>(transform.xy) * transform.yx;
+    if(!std::isfinite(determinant) || determinant == 0 || !std::isfinite(transform.x) || !std::isfinite(transform.y)) {
+        throw std::runtime_error("Overlay transform can not be inverted!");
+    }
+    inverse_[0] = transform.yy / determinant;
+    inverse_[1] = -transform.xy / determinant;
+    inverse_[2] = -transform.yx / determinant;
+    inverse_[3] = transform.xx / determinant;
+    offset_[0] = transform.x;
+    offset_[1] = transform.y;
+    separable_ = transform.AxisAligned();
+    if(source.layout.format == PixelFormat::BGRA32) {
+        resample_row_ = GetResampleRow(kernel, source.layout.premultiplied);
+        resample_pixels_ = GetResampleRow(kernel, source.layout.premultiplied, true);
+    }
+    if(source.width <= 0 || source.height <= 0) {
+        return;
+    }
+
+    // bounding box of the footprint, source positions within half a pixel of the picture get a tap
+    double low[2] = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+    double high[2] = {-low[0], -low[1]};
+    for(double u : {-0.5, source.width + 0.5}) {
+        for(double v : {-0.5, source.height + 0.5}) {
+            double corner[2] = {transform.xx * u + transform.xy * v + transform.x, transform.yx * u + transform.yy * v + transform.y};
+            for(int axis = 0; axis < 2; ++axis) {
+                low[axis] = std::min(low[axis], corner[axis]);
+                high[axis] = std::max(high[axis], corner[axis]);
+            }
+        }
+    }
+    row_begin_ = 0;
+    row_end_ = dst_height;
+    CoveredRange(low[1], high[1], row_begin_, row_end_);
+    column_begin_ = 0;
+    column_end_ = dst_width;
+    CoveredRange(low[0], high[0], column_begin_, column_end_);
+
+    if(!separable_) {
+        auto empty = [this](int row) {
+            std::pair<int, int> columns = Columns(row);
+            return columns.first >= columns.second;
+        };
+        while(row_begin_ < row_end_ && empty(row_begin_)) {
+            ++row_begin_;
+        }
+        while(row_end_ > row_begin_ && empty(row_end_ - 1)) {
+            --row_end_;
+        }
+        return;
+    }
+
+    while(row_begin_ < row_end_ && !RowTaps(0, row_begin_).Covered()) {
+        ++row_begin_;
+    }
+    while(row_end_ > row_begin_ && !RowTaps(0, row_end_ - 1).Covered()) {
+        --row_end_;
+    }
+    while(column_begin_ < column_end_ && !ColumnTaps(column_begin_, 0).Covered()) {
+        ++column_begin_;
+    }
+    while(column_end_ > column_begin_ && !ColumnTaps(column_end_ - 1, 0).Covered()) {
+        --column_end_;
+    }
+    if(row_begin_ >= row_end_ || column_begin_ >= column_end_) {
+        row_end_ = row_begin_;
+        return;
+    }
+
+    for(int row = row_begin_; row < row_end_; ++row) {
+        row_taps_.push_back(RowTaps(0, row));
+    }
+    int bytes = source.layout.BytesPerPixel();
+    for(int column = column_begin_; column < column_end_; ++column) {
+        AxisTaps taps = ColumnTaps(column, 0);
+        column_taps_.push_back(taps);
+        for(int tap = 0; tap < 2; ++tap) {
+            column_offsets_[tap].push_back(taps.index[tap] * bytes);
+            column_weights_[tap].push_back(static_cast<uint32_t>(taps.weight[tap]) * 0x10001u);
+        }
+    }
+}
+
+std::pair<int, int> OverlayResampler::Columns(int row) const {
+    if(separable_) {
+        return {column_begin_, column_end_};
+    }
+
+    // the footprint is convex, so each row crosses it in one run of columns
+    int begin = 0;
+    int end = dst_width_;
+    double y = row + 0.5 - offset_[1];
+    int sizes[2] = {source_.width, source_.height};
+    for(int axis = 0; axis < 2; ++axis) {
+        // source position along this axis is slope * (column + 0.5) + base
+        double slope = inverse_[2 * axis];
+        double base = inverse_[2 * axis + 1] * y - slope * offset_[0];
+        if(slope == 0) {
+            if(!(base > -0.5 && base < sizes[axis] + 0.5)) {
+                return {0, 0};
+            }
+            continue;
+        }
+        double first = (-0.5 - base) / slope;
+        double second = (sizes[axis] + 0.5 - base) / slope;
+        CoveredRange(std::min(first, second), std::max(first, second), begin, end);
+    }
+    while(begin < end && !Covered(begin, row)) {
+        ++begin;
+    }
+    while(end > begin && !Covered(end - 1, row)) {
+        --end;
+    }
+    return {begin, end};
+}
+
+void OverlayResampler::Resample(unsigned char* out, int row, int begin, int count) const {
+    if(!separable_ && resample_pixels_) {
+        int32_t columns[2][RESAMPLE_CHUNK_PIXELS];
+        uint32_t column_weights[2][RESAMPLE_CHUNK_PIXELS];
+        int32_t rows[2][RESAMPLE_CHUNK_PIXELS];
+        uint32_t row_weights[2][RESAMPLE_CHUNK_PIXELS];
+        ResampleTaps taps;
+        for(int tap = 0; tap < 2; ++tap) {
+            taps.rows[tap] = source_.first_row;
+            taps.columns[tap] = columns[tap];
+            taps.column_weights[tap] = column_weights[tap];
+            taps.pixel_rows[tap] = rows[tap];
+            taps.pixel_row_weights[tap] = row_weights[tap];
+        }
+        for(int done = 0; done < count; done += RESAMPLE_CHUNK_PIXELS) {
+            int chunk = std::min(RESAMPLE_CHUNK_PIXELS, count - done);
+            for(int i = 0; i < chunk; ++i) {
+                AxisTaps column_taps = ColumnTaps(begin + done + i, row);
+                AxisTaps row_taps = RowTaps(begin + done + i, row);
+                for(int tap = 0; tap < 2; ++tap) {
+                    columns[tap][i] = column_taps.index[tap] * BYTES_PER_PIXEL;
+                    column_weights[tap][i] = static_cast<uint32_t>(column_taps.weight[tap]) * 0x10001u;
+                    rows[tap][i] = static_cast<int32_t>(row_taps.index[tap] * source_.row_step);
+                    row_weights[tap][i] = static_cast<uint32_t>(row_taps.weight[tap]) * 0x10001u;
+                }
+            }
+            resample_pixels_(out + done * BYTES_PER_PIXEL, taps, chunk);
+        }
+        return;
+    }
+    if(!separable_) {
+        for(int i = 0; i < count; ++i) {
+            SamplePixel(out + i * BYTES_PER_PIXEL, ColumnTaps(begin + i, row), RowTaps(begin + i, row));
+        }
+        return;
+    }
+
+    const AxisTaps& rows = row_taps_[row - row_begin_];
+    int first = begin - column_begin_;
+    if(resample_row_) {
+        ResampleTaps taps;
+        for(int tap = 0; tap < 2; ++tap) {
+            taps.rows[tap] = source_.first_row + rows.index[tap] * source_.row_step;
+            taps.row_weights[tap] = rows.weight[tap];
+            taps.columns[tap] = column_offsets_[tap].data() + first;
+            taps.column_weights[tap] = column_weights_[tap].data() + first;
+        }
+        resample_row_(out, taps, count);
+        return;
+    }
+    for(int i = 0; i < count; ++i) {
+        SamplePixel(out + i * BYTES_PER_PIXEL, column_taps_[first + i], rows);
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "blend.h"
+#include "pixel_format.h"
+
+const int RESAMPLE_CHUNK_PIXELS = 256; // per-pixel taps of rotated overlays, 8 KiB of tables
+
+// Where an overlay lands on the destination, in pixels with y counted from the bottom edge:
+// destination = [xx xy; yx yy] * source + (x, y). Pixel (i, j) covers the square [i, i + 1) x [j, j + 1).
+struct OverlayTransform {
+    float xx = 1.0f;
+    float xy = 0.0f;
+    float yx = 0.0f;
+    float yy = 1.0f;
+    float x = 0.0f;
+    float y = 0.0f;
+
+    // Lower left corner of the overlay at (x, y), scaled by `scale` on both axes.
+    static OverlayTransform Place(float x, float y, float scale = 1.0f) {
+        return {scale, 0.0f, 0.0f, scale, x, y};
+    }
+
+    bool AxisAligned() const noexcept {
+        return xy == 0.0f && yx == 0.0f;
+    }
+
+    // 1:1 scale at whole pixel offsets, every overlay pixel lands exactly on one destination pixel
+    bool IntegerTranslation() const noexcept;
+};
+
+// The part of a BMPFile the resampler reads.
+struct ResampleSource {
+    const unsigned char* first_row = nullptr; // row 0, the bottom one
+    ptrdiff_t row_step = 0;                   // bytes from a row to the one above it, negative for top-down files
+    int width = 0;
+    int height = 0;
+    PixelLayout layout = {};
+};
+
+// Bilinear samples of a transformed overlay for the destination pixels it covers, as premultiplied BGRA.
+// Pixels outside the overlay count as transparent, so its edges are antialiased instead of cut.
+// Scale and translation are separable: the taps of every destination column and row are computed once.
+// Rotated or sheared overlays get their taps per pixel, RESAMPLE_CHUNK_PIXELS at a time. BGRA32 sources
+// are filtered by the SIMD ResampleRow kernels, other layouts pixel by pixel with the same arithmetic.
+class OverlayResampler {
+    private:
+        // The two source pixels around a sample position along one axis.
+        struct AxisTaps {
+            int index[2] = {};
+            int weight[2] = {};
+
+            bool Covered() const noexcept {
+                return weight[0] != 0 || weight[1] != 0;
+            }
+        };
+
+        ResampleSource source_;
+        double inverse_[4] = {}; // source = inverse_ * (destination - offset_)
+        double offset_[2] = {};
+        int dst_width_ = 0;
+        bool separable_ = false;
+        ResampleRowFn resample_row_ = nullptr;    // BGRA32 sources only
+        ResampleRowFn resample_pixels_ = nullptr; // per-pixel rows, BGRA32 sources only
+
+        int row_begin_ = 0;
+        int row_end_ = 0;
+
+        // separable transforms only, indexed from column_begin_ and row_begin_
+        int column_begin_ = 0;
+        int column_end_ = 0;
+        std::vector<AxisTaps> row_taps_;
+        std::vector<AxisTaps> column_taps_;
+        std::vector<int32_t> column_offsets_[2];
+        std::vector<uint32_t> column_weights_[2];
+
+        static AxisTaps MakeTaps(double position, int size);
+        AxisTaps ColumnTaps(int column, int row) const;
+        AxisTaps RowTaps(int column, int row) const;
+        bool Covered(int column, int row) const;
+        void SamplePixel(unsigned char* out, const AxisTaps& columns, const AxisTaps& rows) const;
+
+    public:
+        // Throws std::runtime_error if the transform can not be inverted.
+        OverlayResampler(const ResampleSource& source, const OverlayTransform& transform, int dst_width, int dst_height,
+                         BlendKernel kernel);
+
+        // Destination rows [begin, end) the overlay covers, clipped to the destination.
+        int RowBegin() const noexcept {
+            return row_begin_;
+        }
+
+        int RowEnd() const noexcept {
+            return row_end_;
+        }
+
+        // Destination columns [begin, end) the overlay covers in `row`, clipped to the destination.
+        std::pair<int, int> Columns(int row) const;
+
+        // Samples destination pixels [begin, begin + count) of `row`.
+        void Resample(unsigned char* out, int row, int begin, int count) const;
+};
@@ -0,0 +1,264 @@
+#include "stream_compose.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <vector>
+
+#include "bmp_file.h"
+
+namespace {
+
+class FileDescriptor {
+    private:
+        int fd_ = -1;
+
+    public:
+        FileDescriptor(const char* filename, int flags, mode_t mode = 0) : fd_(open(filename, flags, mode)) {
+            if(fd_ < 0) {
+                throw std::runtime_error("This file does not exist!");
+            }
+        }
+        ~FileDescriptor() {
+            close(fd_);
+        }
+
+        FileDescriptor(const FileDescriptor& other) = delete;
+        FileDescriptor& operator=(const FileDescriptor& other) = delete;
+
+        int Get() const noexcept {
+            return fd_;
+        }
+};
+
+void ReadExact(int fd, unsigned char* buffer, size_t size, off_t offset) {
+    while(size) {
+        ssize_t chunk = pread(fd, buffer, size, offset);
+        if(chunk <= 0) {
+            throw std::runtime_error("Could not read the picture!");
+        }
+        buffer += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+void WriteExact(int fd, const unsigned char* buffer, size_t size, off_t offset) {
+    while(size) {
+        ssize_t chunk = pwrite(fd, buffer, size, offset);
+        if(chunk <= 0) {
+            throw std::runtime_error("Could not write the output file!");
+        }
+        buffer += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+// Copies [begin, end) to the same offsets of the destination file. copy_file_range keeps the bytes inside
+// the kernel (or shares extents on CoW filesystems); pread/pwrite take over where it is not supported.
+void CopyRange(int source_fd, int destination_fd, off_t begin, off_t end) {
+    while(begin < end) {
+        loff_t source_offset = begin;
+        loff_t destination_offset = begin;
+        ssize_t chunk = copy_file_range(source_fd, &source_offset, destination_fd, &destination_offset, end - begin, 0);
+        if(chunk <= 0) {
+            break;
+        }
+        begin += chunk;
+    }
+    if(begin >= end) {
+        return;
+    }
+
+    std::vector<unsigned char> buffer(std::min<off_t>(end - begin, MAP_COPY_BUFFER_SIZE));
+    for(off_t offset = begin; offset < end; offset += buffer.size()) {
+        size_t chunk = std::min<off_t>(end - offset, buffer.size());
+        ReadExact(source_fd, buffer.data(), chunk, offset);
+        WriteExact(destination_fd, buffer.data(), chunk, offset);
+    }
+}
+
+struct StreamPicture {
+    BMPHeader header = {};
+    PixelLayout layout = {};
+    off_t file_size = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+    int width = 0;
+    int height = 0;
+    bool top_down = false;
+
+    explicit StreamPicture(int fd) {
+        struct stat file_stat = {};
+        if(fstat(fd, &file_stat) != 0) {
+            throw std::runtime_error("This file is not a BMP picture!");
+        }
+        file_size = file_stat.st_size;
+        device = file_stat.st_dev;
+        inode = file_stat.st_ino;
+        unsigned char header_bytes[sizeof(BMPHeader)];
+        ReadExact(fd, header_bytes, std::min<off_t>(file_size, sizeof(header_bytes)), 0);
+        header = ReadBMPHeader(header_bytes, file_size);
+        layout = MakePixelLayout(header.bV5Size, header.bV5BitCount, header.biV5Compression,
+                                 header.bV5RedMask, header.bV5GreenMask, header.bV5BlueMask, header.bV5AlphaMask);
+
+        int32_t signed_height = static_cast<int32_t>(header.bV5Height);
+        width = header.bV5Width;
+        height = std::abs(signed_height);
+        top_down = signed_height < 0;
+        if(header.bfOffBits + static_cast<off_t>(RowBytes()) * height > file_size) {
+            throw std::runtime_error("This file is not a BMP picture!");
+        }
+    }
+
+    size_t RowBytes() const noexcept {
+        return layout.Stride(width);
+    }
+
+    bool SameFile(int fd) const {
+        struct stat file_stat = {};
+        if(fstat(fd, &file_stat) != 0) {
+            throw std::runtime_error("Could not write the output file!");
+        }
+        return file_stat.st_dev == device && file_stat.st_ino == inode;
+    }
+
+    // stored rows run bottom-up for positive heights and top-down for negative ones
+    int StoredRow(int row_from_bottom) const noexcept {
+        return top_down ? height - 1 - row_from_bottom : row_from_bottom;
+    }
+
+    off_t RowOffset(int stored_row) const noexcept {
+        return header.bfOffBits + static_cast<off_t>(stored_row) * RowBytes();
+    }
+};
+
+struct Band {
+    std::vector<unsigned char> rows;
+    std::vector<unsigned char> overlay_rows;
+    int first_row = 0;          // stored destination row
+    int row_count = 0;
+    int overlay_first_row = 0;  // stored overlay row held in overlay_rows[0]
+    int overlay_row_count = 0;
+};
+
+} // namespace
+
+void ComposeStreaming(const char* destination, const char* overlay, int x, int y, const char* output,
+                      const StreamOptions& options) {
+    FileDescriptor destination_fd(destination, O_RDONLY);
+    FileDescriptor overlay_fd(overlay, O_RDONLY);
+    StreamPicture dest(destination_fd.Get());
+    StreamPicture over(overlay_fd.Get());
+    if(x < 0 || y < 0 || x + over.width > dest.width || y + over.height > dest.height) {
+        throw std::runtime_error("Argument picture must be smaller than dest!");
+    }
+
+    RowBlender blend_row(dest.layout, over.layout, options.compose);
+    // not truncated on open: the output may be the destination itself, which is then composed in place
+    FileDescriptor output_fd(output, O_WRONLY | O_CREAT, 0644);
+    if(over.SameFile(output_fd.Get())) {
+        throw std::runtime_error("Output file must not be the overlay!");
+    }
+
+    // only the stored rows under the overlay go through the bands, the rest of the file is never touched
+    int first_covered = dest.top_down ? dest.height - y - over.height : y;
+    int last_covered = first_covered + over.height;
+    if(!dest.SameFile(output_fd.Get())) {
+        if(ftruncate(output_fd.Get(), 0) != 0) {
+            throw std::runtime_error("Could not write the output file!");
+        }
+        CopyRange(destination_fd.Get(), output_fd.Get(), 0, dest.RowOffset(first_covered));
+        CopyRange(destination_fd.Get(), output_fd.Get(), dest.RowOffset(last_covered), dest.file_size);
+    }
+
+    int band_rows = options.band_rows;
+    if(band_rows <= 0) {
+        band_rows = std::max<int>(1, STREAM_BAND_BYTES / std::max<size_t>(1, dest.RowBytes()));
+    }
+    int bands = (over.height + band_rows - 1) / band_rows;
+
+    // overlay row i (from the bottom) lands on destination row y + i (from the bottom)
+    auto overlay_row_for = [&](int dest_stored_row) {
+        return dest.StoredRow(dest_stored_row) - y;
+    };
+
+    auto read_band = [&](Band& band, int index) {
+        band.first_row = first_covered + index * band_rows;
+        band.row_count = std::min(band_rows, last_covered - band.first_row);
+        band.rows.resize(band.row_count * dest.RowBytes());
+        ReadExact(destination_fd.Get(), band.rows.data(), band.rows.size(), dest.RowOffset(band.first_row));
+
+        int first = overlay_row_for(band.first_row);
+        int last = overlay_row_for(band.first_row + band.row_count - 1);
+        int low = std::max(0, std::min(first, last));
+        int high = std::min(over.height - 1, std::max(first, last));
+        band.overlay_row_count = std::max(0, high - low + 1);
+        if(band.overlay_row_count) {
+            int stored_low = std::min(over.StoredRow(low), over.StoredRow(high));
+            band.overlay_first_row = stored_low;
+            band.overlay_rows.resize(band.overlay_row_count * over.RowBytes());
+            ReadExact(overlay_fd.Get(), band.overlay_rows.data(), band.overlay_rows.size(), over.RowOffset(stored_low));
+        }
+    };
+
+    auto blend_band = [&](Band& band) {
+        for(int row = 0; row < band.row_count; ++row) {
+            int overlay_row = overlay_row_for(band.first_row + row);
+            if(overlay_row < 0 || overlay_row >= over.height) {
+                continue;
+            }
+            int overlay_index = over.StoredRow(overlay_row) - band.overlay_first_row;
+            blend_row(band.rows.data() + row * dest.RowBytes() + x * dest.layout.BytesPerPixel(),
+                      band.overlay_rows.data() + overlay_index * over.RowBytes(), over.width);
+        }
+    };
+
+    const int SLOTS = 3;
+    Band slots[SLOTS];
+    std::future<void> reads[SLOTS];
+    std::future<void> writes[SLOTS];
+    auto start_read = [&](int index) {
+        int slot = index % SLOTS;
+        if(writes[slot].valid()) {
+            writes[slot].get();
+        }
+        reads[slot] = std::async(std::launch::async, read_band, std::ref(slots[slot]), index);
+    };
+
+    try {
+        if(bands) {
+            start_read(0);
+        }
+        for(int index = 0; index < bands; ++index) {
+            int slot = index % SLOTS;
+            if(index + 1 < bands) {
+                start_read(index + 1);
+            }
+            reads[slot].get();
+            blend_band(slots[slot]);
+            writes[slot] = std::async(std::launch::async, [&, slot] {
+                const Band& band = slots[slot];
+                WriteExact(output_fd.Get(), band.rows.data(), band.rows.size(), dest.RowOffset(band.first_row));
+            });
+        }
+    } catch(...) {
+        // let in-flight I/O finish before the buffers and descriptors go away
+        for(int slot = 0; slot < SLOTS; ++slot) {
+            if(reads[slot].valid()) {
+                reads[slot].wait();
+            }
+            if(writes[slot].valid()) {
+                writes[slot].wait();
+            }
+        }
+        throw;
+    }
+    for(auto& write : writes) {
+        if(write.valid()) {
+            write.get();
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "blend.h"
+
+const int STREAM_BAND_BYTES = 4 * 1024 * 1024;
+
+struct StreamOptions {
+    int band_rows = 0; // destination rows per band, 0 picks bands of about STREAM_BAND_BYTES
+    ComposeOptions compose = {};
+};
+
+// Composes the overlay picture at (x, y) over the destination picture and writes the result to output
+// without holding either picture in memory. The destination rows under the overlay are read, blended and
+// written in bands through three rotating buffers, so reading band k + 1 and writing band k - 1 overlap
+// with blending band k; all other bytes are copied file to file, or not touched at all in place.
+// Peak memory is about 3 bands of destination rows plus the matching overlay rows.
+// As in BMPFile::ComposeAlpha, y counts rows from the bottom edge; top-down pictures (negative
+// height) are handled by walking their rows in reverse. Any layout BMPFile accepts can be streamed.
+// output may be the destination file, which is then composed in place; it must not be the overlay.
+void ComposeStreaming(const char* destination, const char* overlay, int x, int y, const char* output,
+                      const StreamOptions& options = {});
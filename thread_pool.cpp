@@ -0,0 +1,121 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+ThreadPool::ThreadPool(int threads) {
+    if(threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(int i = 0; i < threads; ++i) {
+        queues_.push_back(std::make_unique<WorkQueue>());
+    }
+    for(int i = 1; i < threads; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for(auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::PopTask(int self, int& index) {
+    {
+        WorkQueue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.items.empty()) {
+            index = own.items.front();
+            own.items.pop_front();
+            return true;
+        }
+    }
+    for(int i = 1; i < Size(); ++i) {
+        WorkQueue& victim = *queues_[(self + i) % Size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.items.empty()) {
+            index = victim.items.back();
+            victim.items.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::RunTasks(int self) {
+    int index = 0;
+    while(PopTask(self, index)) {
+        try {
+            (*task_)(index);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        if(remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(int self) {
+    uint64_t seen_generation = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+            if(stopping_) {
+                return;
+            }
+            seen_generation = generation_;
+        }
+        RunTasks(self);
+    }
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& task) {
+    if(count <= 0) {
+        return;
+    }
+    if(Size() == 1) {
+        for(int i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    task_ = &task;
+    error_ = nullptr;
+    remaining_.store(count, std::memory_order_release);
+
+    // contiguous blocks per thread keep neighbouring bands on the same core, stealing takes from the far end
+    for(int i = 0; i < Size(); ++i) {
+        WorkQueue& queue = *queues_[i];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for(int index = static_cast<int>(int64_t(count) * i / Size()); index < int64_t(count) * (i + 1) / Size(); ++index) {
+            queue.items.push_back(index);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return remaining_.load(std::memory_order_acquire) == 0; });
+    if(error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
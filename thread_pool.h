@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool with per-thread work queues. Each thread drains its own queue first and then steals
+// from the others, so uneven bands get rebalanced. The calling thread takes part in every ParallelFor,
+// so a pool of size 1 has no workers and runs everything in order on the caller.
+class ThreadPool {
+    private:
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<int> items;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> queues_;
+        std::vector<std::thread> workers_;
+
+        std::mutex mutex_;
+        std::mutex run_mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        uint64_t generation_ = 0;
+        bool stopping_ = false;
+
+        const std::function<void(int)>* task_ = nullptr;
+        std::atomic<int> remaining_{0};
+        std::exception_ptr error_;
+
+        bool PopTask(int self, int& index);
+        void RunTasks(int self);
+        void WorkerLoop(int self);
+
+    public:
+        // threads <= 0 uses std::thread::hardware_concurrency()
+        explicit ThreadPool(int threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool& other) = delete;
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+
+        int Size() const noexcept {
+            return static_cast<int>(queues_.size());
+        }
+
+        // Calls task(index) for every index in [0, count) and blocks until all of them finished.
+        // The first exception thrown by a task is rethrown here.
+        void ParallelFor(int count, const std::function<void(int)>& task);
+};